@@ -0,0 +1,248 @@
+#include "app_context.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "image_compare.h"
+
+#ifdef SCENE_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace {
+#ifdef SCENE_HEADLESS
+    // Mesa's surfaceless platform works without X, Wayland or a GPU; the default
+    // display is the fallback for drivers that don't expose it
+    EGLDisplay GetHeadlessDisplay() {
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (getPlatformDisplay != nullptr && extensions != nullptr
+            && std::string(extensions).find("EGL_MESA_platform_surfaceless") != std::string::npos) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (display != EGL_NO_DISPLAY) {
+                return display;
+            }
+        }
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    bool CreateHeadlessContext(AppContext& app) {
+        EGLDisplay display = GetHeadlessDisplay();
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+            std::cerr << "Can't initialize an EGL display\n";
+            return false;
+        }
+        app.eglDisplay = display;
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            std::cerr << "EGL display doesn't support desktop OpenGL\n";
+            return false;
+        }
+
+        const EGLint configAttributes[] = {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs == 0) {
+            std::cerr << "No EGL config for offscreen OpenGL\n";
+            return false;
+        }
+
+        const EGLint contextAttributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 3,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+        };
+        EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT) {
+            std::cerr << "Can't create an OpenGL 3.3 core EGL context\n";
+            return false;
+        }
+        app.eglContext = context;
+
+        std::string extensions = eglQueryString(display, EGL_EXTENSIONS);
+        EGLSurface surface = EGL_NO_SURFACE;
+        if (extensions.find("EGL_KHR_surfaceless_context") == std::string::npos) {
+            const EGLint surfaceAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+            surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+            app.eglSurface = surface;
+        }
+        if (!eglMakeCurrent(display, surface, surface, context)) {
+            std::cerr << "Can't make the EGL context current\n";
+            return false;
+        }
+        return true;
+    }
+
+    void CreateOffscreenFrameBuffer(AppContext& app) {
+        glGenFramebuffers(1, &app.frameBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, app.frameBuffer);
+
+        glGenRenderbuffers(1, &app.colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, app.colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, app.width, app.height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, app.colorBuffer);
+
+        glGenRenderbuffers(1, &app.depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, app.depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, app.width, app.height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, app.depthBuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+            exit(1);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+#endif
+}
+
+bool CreateAppContext(AppContext& app, const AppContextSettings& settings) {
+    app.headless = settings.headless;
+
+    if (settings.headless) {
+#ifdef SCENE_HEADLESS
+        if (!CreateHeadlessContext(app)) {
+            return false;
+        }
+        // GLEW looks for a GLX display as well, which a surfaceless context doesn't have
+        glewExperimental = GL_TRUE;
+        GLenum status = glewInit();
+        if (status != GLEW_OK && status != GLEW_ERROR_NO_GLX_DISPLAY) {
+            std::cerr << "Failed to initialize OpenGL loader!\n";
+            return false;
+        }
+        app.width = settings.width;
+        app.height = settings.height;
+        CreateOffscreenFrameBuffer(app);
+        return true;
+#else
+        std::cerr << "Built without headless support (SCENE_HEADLESS)\n";
+        return false;
+#endif
+    }
+
+    if (!glfwInit()) {
+        return false;
+    }
+
+    // GL 3.3 + GLSL 330
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // 3.0+ only
+
+    // Create window with graphics context
+    app.window = glfwCreateWindow(settings.width, settings.height, settings.title.c_str(), NULL, NULL);
+    if (app.window == NULL) {
+        return false;
+    }
+    glfwMakeContextCurrent(app.window);
+    glfwSwapInterval(settings.vsync ? 1 : 0);
+
+    // Initialize GLEW, i.e. fill all possible function pointers for current OpenGL context
+    if (glewInit() != GLEW_OK) {
+        std::cerr << "Failed to initialize OpenGL loader!\n";
+        return false;
+    }
+    return true;
+}
+
+void DestroyAppContext(AppContext& app) {
+    if (app.window != nullptr) {
+        glfwDestroyWindow(app.window);
+        glfwTerminate();
+        app.window = nullptr;
+    }
+#ifdef SCENE_HEADLESS
+    if (app.eglDisplay != nullptr) {
+        if (app.frameBuffer != 0) {
+            glDeleteFramebuffers(1, &app.frameBuffer);
+            glDeleteRenderbuffers(1, &app.colorBuffer);
+            glDeleteRenderbuffers(1, &app.depthBuffer);
+        }
+        eglMakeCurrent(app.eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (app.eglSurface != nullptr) {
+            eglDestroySurface(app.eglDisplay, app.eglSurface);
+        }
+        if (app.eglContext != nullptr) {
+            eglDestroyContext(app.eglDisplay, app.eglContext);
+        }
+        eglTerminate(app.eglDisplay);
+        app.eglDisplay = nullptr;
+    }
+#endif
+}
+
+bool AppShouldClose(AppContext& app) {
+    return app.window != nullptr && glfwWindowShouldClose(app.window);
+}
+
+void AppFrameBufferSize(AppContext& app, int& width, int& height) {
+    if (app.headless) {
+        width = app.width;
+        height = app.height;
+    } else {
+        glfwGetFramebufferSize(app.window, &width, &height);
+    }
+}
+
+unsigned int AppFrameBuffer(const AppContext& app) {
+    return app.frameBuffer;
+}
+
+void PresentApp(AppContext& app) {
+    if (app.headless) {
+        glFinish();
+    } else {
+        glfwSwapBuffers(app.window);
+        glfwPollEvents();
+    }
+}
+
+bool AppKeyPressed(AppContext& app, int key) {
+    return !app.headless && glfwGetKey(app.window, key) == GLFW_PRESS;
+}
+
+bool AppMouseButtonPressed(AppContext& app, int button) {
+    return !app.headless && glfwGetMouseButton(app.window, button) == GLFW_PRESS;
+}
+
+void AppCursor(AppContext& app, double& x, double& y, int& windowWidth, int& windowHeight) {
+    if (app.headless) {
+        x = 0;
+        y = 0;
+        windowWidth = app.width;
+        windowHeight = app.height;
+        return;
+    }
+    glfwGetCursorPos(app.window, &x, &y);
+    glfwGetWindowSize(app.window, &windowWidth, &windowHeight);
+}
+
+bool SaveAppFrame(AppContext& app, const std::string& path) {
+    int width, height;
+    AppFrameBufferSize(app, width, height);
+    std::vector<unsigned char> pixels(3 * width * height);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, AppFrameBuffer(app));
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    // GL rows run bottom to top
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(pixels.size());
+    for (int y = 0; y < height; y++) {
+        std::copy(pixels.begin() + 3 * width * (height - 1 - y), pixels.begin() + 3 * width * (height - y),
+                  image.pixels.begin() + 3 * width * y);
+    }
+    return SavePpm(image, path);
+}
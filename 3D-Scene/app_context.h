@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+
+#include <GL/glew.h>
+// Include glfw3.h after our OpenGL definitions
+#include <GLFW/glfw3.h>
+
+// Where the frames go: a GLFW window, or with headless set an offscreen
+// framebuffer in a surfaceless EGL context (Mesa's llvmpipe does without a GPU
+// or a display). Input reads as idle while headless.
+struct AppContextSettings {
+    int width = 1280;
+    int height = 720;
+    bool headless = false;
+    bool vsync = true;      // windowed only
+    std::string title = "Dear ImGui - Conan";
+};
+
+struct AppContext {
+    bool headless = false;
+    GLFWwindow* window = nullptr;
+
+    // Headless only
+    void* eglDisplay = nullptr;
+    void* eglContext = nullptr;
+    void* eglSurface = nullptr;     // a 1x1 pbuffer if surfaceless contexts aren't supported
+    int width = 0;
+    int height = 0;
+    unsigned int frameBuffer = 0;
+    unsigned int colorBuffer = 0;
+    unsigned int depthBuffer = 0;
+};
+
+// Creates the context, makes it current and loads the GL functions. Prints the
+// reason and returns false on failure.
+bool CreateAppContext(AppContext& app, const AppContextSettings& settings);
+void DestroyAppContext(AppContext& app);
+
+bool AppShouldClose(AppContext& app);
+void AppFrameBufferSize(AppContext& app, int& width, int& height);
+
+// The framebuffer presented frames end up in: 0 for the window
+unsigned int AppFrameBuffer(const AppContext& app);
+
+// Swaps the window's buffers, or waits for the offscreen frame to finish so
+// frame times include the GPU
+void PresentApp(AppContext& app);
+
+bool AppKeyPressed(AppContext& app, int key);
+bool AppMouseButtonPressed(AppContext& app, int button);
+void AppCursor(AppContext& app, double& x, double& y, int& windowWidth, int& windowHeight);
+
+// Reads the presented frame back and writes it as a binary PPM
+bool SaveAppFrame(AppContext& app, const std::string& path);
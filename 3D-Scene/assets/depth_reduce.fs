@@ -0,0 +1,22 @@
+#version 330 core
+
+// One step down the min/max chain: 2x2 texels of the previous level per texel.
+uniform sampler2D rangeTexture;
+
+out vec2 o_range;
+
+void main()
+{
+    ivec2 size = textureSize(rangeTexture, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    vec2 range = vec2(1e30, -1e30);
+
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            vec2 r = texelFetch(rangeTexture, min(base + ivec2(x, y), size - 1), 0).rg;
+            range = vec2(min(range.x, r.x), max(range.y, r.y));
+        }
+    }
+
+    o_range = range;
+}
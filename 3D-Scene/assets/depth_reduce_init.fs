@@ -0,0 +1,34 @@
+#version 330 core
+
+// First step of the depth reduction: every output texel holds the min/max view
+// depth of a 2x2 block of the depth buffer. Pixels at or beyond maxDepth (the
+// sky box) are not part of the scene and are skipped.
+uniform sampler2D depthTexture;
+uniform float nearPlane;
+uniform float farPlane;
+uniform float maxDepth;
+
+out vec2 o_range;
+
+float view_depth(float depth) {
+    float ndc = depth * 2.0 - 1.0;
+    return 2.0 * nearPlane * farPlane / (farPlane + nearPlane - ndc * (farPlane - nearPlane));
+}
+
+void main()
+{
+    ivec2 size = textureSize(depthTexture, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    vec2 range = vec2(1e30, -1e30);
+
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            float z = view_depth(texelFetch(depthTexture, min(base + ivec2(x, y), size - 1), 0).r);
+            if (z < maxDepth) {
+                range = vec2(min(range.x, z), max(range.y, z));
+            }
+        }
+    }
+
+    o_range = range;
+}
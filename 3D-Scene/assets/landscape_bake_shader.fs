@@ -0,0 +1,13 @@
+#version 330 core
+
+out vec4 o_frag_color;
+
+in vec3 aPosition;
+in vec2 aTexCoords;
+
+#include "terrain_material.glsl"
+
+void main()
+{
+    o_frag_color = terrain_albedo(aPosition, aTexCoords);
+}
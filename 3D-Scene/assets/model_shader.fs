@@ -5,6 +5,8 @@ out vec4 o_frag_color;
 in vec3 aPosition;
 in vec3 aNormal;
 in vec2 aTexCoords;
+in vec4 aWorldPosition;
+in float z;
 
 uniform vec3 in_diffuse;
 uniform vec3 in_specular;
@@ -19,6 +21,8 @@ uniform float projectorAngle;
 
 uniform vec3 cameraPosition;
 
+#include "shadow_cascades.glsl"
+
 void main()
 {
     float ambientStrength = 0.5;
@@ -45,7 +49,9 @@ void main()
     vec3 sunR = reflect(-sunDirection, normalize(aNormal));
     vec3 sunSpecular = pow(max(dot(I, sunR), 0.0), 16) * in_specular * sunColor;
 
-    vec4 result = vec4(sunAmbient + sunDiffuse + sunSpecular, 1.0);
+    float shadow = get_shadow(aWorldPosition, z, normalize(aNormal), sunDirection);
+
+    vec4 result = vec4(sunAmbient + (1.0 - shadow) * (sunDiffuse + sunSpecular), 1.0);
 
     o_frag_color = result * texture(texture_diffuse1, aTexCoords);
 }
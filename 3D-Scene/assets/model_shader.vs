@@ -17,6 +17,8 @@ uniform float waterNormal;
 out vec3 aPosition;
 out vec3 aNormal;
 out vec2 aTexCoords;
+out vec4 aWorldPosition;
+out float z;
 
 void main()
 {
@@ -25,6 +27,8 @@ void main()
     vec4 pos = vec4(in_position, 1.0);
     aPosition = in_position;
     vec4 modelPosition = model * pos;
+    aWorldPosition = modelPosition;
     gl_Position = projection * view * model * pos;
+    z = gl_Position.z;
     gl_ClipDistance[0] = waterNormal * (modelPosition.y + 0.01 - waterLevel);
 }
@@ -0,0 +1,133 @@
+// Cascaded sun shadows and the projector's spot shadow, shared by the landscape
+// and model shaders. All views live in one depth atlas described by the
+// ShadowViews block. The cascade is picked from the fragment's clip-space depth,
+// then blended into the next one over the last cascadeBlend fraction of its
+// range to hide the seam.
+layout (std140) uniform ShadowViews {
+    mat4 shadowViewMatrices[4];
+    vec4 shadowViewRects[4];    // (scale.xy, offset.xy) in atlas uv
+};
+uniform sampler2DShadow shadowAtlas;
+uniform bool receiveShadows;
+uniform float plane1;
+uniform float plane2;
+uniform float plane3;
+uniform float cascadeBlend;
+uniform int projectorShadowView;
+// Static casters around the projector, see StaticShadowCube; (near, far) of its faces
+uniform samplerCubeShadow projectorShadowCube;
+uniform vec2 projectorShadowDepth;
+
+// Exponential variance mode, see ShadowMap::useMoments
+uniform bool useShadowMoments;
+uniform sampler2D shadowMoments;
+uniform float shadowExponent;
+
+// Chebyshev upper bound on the lit fraction; the low end is cut off to reduce
+// light bleeding where shadows overlap.
+float sample_moments(vec2 uv, float depth, vec2 dx, vec2 dy) {
+    vec2 moments = textureGrad(shadowMoments, uv, dx, dy).rg;
+    float w = exp(shadowExponent * depth);
+    if (w <= moments.x) {
+        return 0.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, 1e-5 * w * w);
+    float d = w - moments.x;
+    float lit = variance / (variance + d * d);
+    return 1.0 - clamp((lit - 0.3) / 0.7, 0.0, 1.0);
+}
+
+// The atlas uses GL_LINEAR with depth comparison, so every fetch is already a
+// bilinear 2x2 PCF; four fetches half a texel apart cover a 3x3 footprint. Taps
+// are kept half a texel inside the view's region so they never read a neighbour.
+float sample_pcf(int i, vec2 uv, float depth) {
+    vec4 rect = shadowViewRects[i];
+    vec2 texelSize = 1.0 / textureSize(shadowAtlas, 0);
+    vec2 low = rect.zw + 0.5 * texelSize;
+    vec2 high = rect.zw + rect.xy - 0.5 * texelSize;
+    vec2 center = uv * rect.xy + rect.zw;
+    float lit = texture(shadowAtlas, vec3(clamp(center + vec2(-0.5, -0.5) * texelSize, low, high), depth))
+              + texture(shadowAtlas, vec3(clamp(center + vec2(0.5, -0.5) * texelSize, low, high), depth))
+              + texture(shadowAtlas, vec3(clamp(center + vec2(-0.5, 0.5) * texelSize, low, high), depth))
+              + texture(shadowAtlas, vec3(clamp(center + vec2(0.5, 0.5) * texelSize, low, high), depth));
+    return 1.0 - 0.25 * lit;
+}
+
+// dx/dy are the screen-space derivatives of worldPosition, taken outside the
+// non-uniform cascade branches.
+float sample_cascade(int i, vec4 worldPosition, vec4 dx, vec4 dy, float bias) {
+    vec3 projCoords = (shadowViewMatrices[i] * worldPosition).xyz * 0.5 + 0.5;
+
+    // Beyond the cascade there are no shadows
+    if (projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))) {
+        return 0.0;
+    }
+
+    if (useShadowMoments) {
+        vec4 rect = shadowViewRects[i];
+        vec2 uvDx = 0.5 * (shadowViewMatrices[i] * dx).xy * rect.xy;
+        vec2 uvDy = 0.5 * (shadowViewMatrices[i] * dy).xy * rect.xy;
+        vec2 halfTexel = 0.5 / vec2(textureSize(shadowMoments, 0));
+        vec2 uv = clamp(projCoords.xy * rect.xy + rect.zw, rect.zw + halfTexel, rect.zw + rect.xy - halfTexel);
+        return sample_moments(uv, projCoords.z, uvDx, uvDy);
+    }
+
+    return sample_pcf(i, projCoords.xy, projCoords.z - bias);
+}
+
+float get_shadow(vec4 worldPosition, float depth, vec3 normal, vec3 sunDirection) {
+    if (!receiveShadows) {
+        return 0.0;
+    }
+    float bias = max(0.005 * (1.0 - dot(normal, sunDirection)), 0.0005);
+    vec4 dx = dFdx(worldPosition);
+    vec4 dy = dFdy(worldPosition);
+
+    int i = depth <= plane1 ? 0 : (depth <= plane2 ? 1 : 2);
+    float shadow = sample_cascade(i, worldPosition, dx, dy, bias);
+
+    if (i < 2 && cascadeBlend > 0.0) {
+        float begin = i == 0 ? 0.0 : plane1;
+        float end = i == 0 ? plane1 : plane2;
+        float blendStart = end - cascadeBlend * (end - begin);
+        if (depth > blendStart) {
+            float t = (depth - blendStart) / (end - blendStart);
+            shadow = mix(shadow, sample_cascade(i + 1, worldPosition, dx, dy, bias), t);
+        }
+    }
+
+    return shadow;
+}
+
+// Shadow of the projector's spotlight: the static casters come from the cube
+// around the projector, the moving ones from its atlas view. Everything outside
+// the frustum is left to the projector's own cone test.
+float get_spot_shadow(vec4 worldPosition, vec3 lightPosition, float bias) {
+    if (!receiveShadows) {
+        return 0.0;
+    }
+    vec3 ray = worldPosition.xyz - lightPosition;
+    float n = projectorShadowDepth.x;
+    float f = projectorShadowDepth.y;
+    float distance = max(max(abs(ray.x), abs(ray.y)), abs(ray.z));
+    if (distance >= f) {
+        return 0.0;
+    }
+    // Depth along the face's axis, pulled towards the light by about a texel at 512
+    distance = max(n, distance - 0.02 - 0.005 * distance);
+    float reference = 0.5 * ((f + n) / (f - n) - 2.0 * f * n / ((f - n) * distance)) + 0.5;
+    float shadow = 1.0 - texture(projectorShadowCube, vec4(ray, reference));
+
+    if (projectorShadowView < 0) {
+        return shadow;
+    }
+    vec4 p = shadowViewMatrices[projectorShadowView] * worldPosition;
+    if (p.w <= 0.0) {
+        return shadow;
+    }
+    vec3 projCoords = p.xyz / p.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))) {
+        return shadow;
+    }
+    return max(shadow, sample_pcf(projectorShadowView, projCoords.xy, projCoords.z - bias));
+}
@@ -0,0 +1,56 @@
+#version 330 core
+
+// Routes each caster triangle (in world space, view and projection are identity)
+// to every shadow view whose frustum it overlaps. GL 3.3 has no viewport arrays,
+// so the view's clip space is squeezed into its atlas region here and clip
+// distances cut the triangle at the region's edges. Views whose bit is clear in
+// viewMask are left untouched.
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 12) out;
+
+// Matches ShadowMap::viewBuffer; rects are (scale.xy, offset.xy) in atlas uv
+layout (std140) uniform ShadowViews {
+    mat4 shadowViewMatrices[4];
+    vec4 shadowViewRects[4];
+};
+uniform int viewMask;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+    float gl_ClipDistance[4];
+};
+
+void emit(vec4 p, vec4 rect) {
+    gl_ClipDistance[0] = p.w - p.x;
+    gl_ClipDistance[1] = p.w + p.x;
+    gl_ClipDistance[2] = p.w - p.y;
+    gl_ClipDistance[3] = p.w + p.y;
+    gl_Position = vec4(p.xy * rect.xy + p.w * (rect.xy + 2.0 * rect.zw - 1.0), p.zw);
+    EmitVertex();
+}
+
+void main()
+{
+    for (int view = 0; view < 4; view++) {
+        if ((viewMask & (1 << view)) == 0) {
+            continue;
+        }
+
+        vec4 p0 = shadowViewMatrices[view] * gl_in[0].gl_Position;
+        vec4 p1 = shadowViewMatrices[view] * gl_in[1].gl_Position;
+        vec4 p2 = shadowViewMatrices[view] * gl_in[2].gl_Position;
+
+        // Skip the view when all three vertices are beyond the same side
+        if ((p0.x > p0.w && p1.x > p1.w && p2.x > p2.w) || (p0.x < -p0.w && p1.x < -p1.w && p2.x < -p2.w)
+            || (p0.y > p0.w && p1.y > p1.w && p2.y > p2.w) || (p0.y < -p0.w && p1.y < -p1.w && p2.y < -p2.w)
+            || (p0.w <= 0.0 && p1.w <= 0.0 && p2.w <= 0.0)) {
+            continue;
+        }
+
+        vec4 rect = shadowViewRects[view];
+        emit(p0, rect);
+        emit(p1, rect);
+        emit(p2, rect);
+        EndPrimitive();
+    }
+}
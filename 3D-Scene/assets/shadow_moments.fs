@@ -0,0 +1,41 @@
+#version 330 core
+
+// Builds exponential variance shadow map moments for one atlas region with a
+// separable Gaussian. The horizontal pass reads the depth region and warps every
+// tap to (e^(c d), e^(2 c d)) before blurring; the vertical pass blurs those
+// moments. Taps are clamped to the region so neighbouring views never leak in.
+uniform sampler2D depthMap;
+uniform sampler2D moments;
+uniform bool fromDepth;
+uniform vec2 sourceOffset;
+uniform vec2 targetOffset;
+uniform int regionSize;
+uniform int radius;
+uniform float exponent;
+
+out vec2 o_moments;
+
+vec2 warp(float depth) {
+    float w = exp(exponent * depth);
+    return vec2(w, w * w);
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy) - ivec2(targetOffset);
+    ivec2 source = ivec2(sourceOffset);
+    ivec2 direction = fromDepth ? ivec2(1, 0) : ivec2(0, 1);
+    float sigma = max(0.5 * float(radius), 0.5);
+
+    vec2 sum = vec2(0.0);
+    float weightSum = 0.0;
+    for (int k = -radius; k <= radius; k++) {
+        ivec2 q = source + clamp(p + direction * k, ivec2(0), ivec2(regionSize - 1));
+        float weight = exp(-0.5 * float(k * k) / (sigma * sigma));
+        vec2 m = fromDepth ? warp(texelFetch(depthMap, q, 0).r) : texelFetch(moments, q, 0).rg;
+        sum += weight * m;
+        weightSum += weight;
+    }
+
+    o_moments = sum / weightSum;
+}
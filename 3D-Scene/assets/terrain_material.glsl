@@ -0,0 +1,16 @@
+uniform sampler2D sand_texture;
+uniform sampler2D grass_texture;
+uniform sampler2D rock_texture;
+uniform float sand_threshold;
+uniform float grass_threshold;
+
+// Sand, grass and rock blended by height
+vec4 terrain_albedo(vec3 position, vec2 texCoords) {
+    if (position.y < sand_threshold - 0.001) {
+        return mix(texture(sand_texture, texCoords), texture(grass_texture, texCoords), clamp(0, 1, 1 / (sand_threshold - position.y) / 100));
+    } else if (position.y < grass_threshold) {
+        return texture(grass_texture, texCoords);
+    } else {
+        return mix(texture(grass_texture, texCoords), texture(rock_texture, texCoords), clamp(0, 1, pow((position.y - grass_threshold) * 4, 2)));
+    }
+}
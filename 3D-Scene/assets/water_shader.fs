@@ -5,12 +5,20 @@ out vec4 o_frag_color;
 in vec3 aPosition;
 in vec4 aClipCoords;
 in vec2 aTexCoords;
+in vec4 aWorldPosition;
 
 uniform sampler2D water_normal;
 uniform sampler2D water_dudv;
 
 uniform sampler2D reflection_texture;
+// Main pass color and depth copied before the water was drawn
 uniform sampler2D refraction_texture;
+uniform sampler2D refraction_depth;
+uniform bool useRefraction;
+uniform vec2 depthRange;
+// The reflection may be a few frames old; the surface point is projected with
+// the mirrored camera it was rendered from
+uniform mat4 reflectionViewProjection;
 
 uniform vec3 sunPosition;
 uniform vec3 projectorPosition;
@@ -21,13 +29,19 @@ uniform float windFactor;
 
 uniform vec3 cameraPosition;
 
+float linear_depth(float depth) {
+    float z = depth * 2.0 - 1.0;
+    return 2.0 * depthRange.x * depthRange.y / (depthRange.y + depthRange.x - z * (depthRange.y - depthRange.x));
+}
+
 void main()
 {
     float specularStrength = 9.0;
     float windStrength = 0.02;
 
     vec2 ndc = (aClipCoords.xy / aClipCoords.w) / 2.0 + 0.5;
-    vec2 R = vec2(ndc.x, 1 - ndc.y);
+    vec4 reflectionClip = reflectionViewProjection * aWorldPosition;
+    vec2 R = (reflectionClip.xy / reflectionClip.w) / 2.0 + 0.5;
     vec2 R2 = vec2(ndc.x, ndc.y);
 
     vec2 dudv_1 = texture(water_dudv, vec2(aTexCoords.x + windFactor, aTexCoords.y)).xy * 0.1;
@@ -77,6 +91,18 @@ void main()
 
     vec3 result = clamp(sunAmbient + sunDiffuse + projectorAttenuation * projectorDiffuse, 0.0, 1.0);
 
-    o_frag_color = vec4(result * mix(vec4(texture(reflection_texture, R).rgb + sunSpecular, 1.0), vec4(0, 87.0 / 256, 143.0 / 256, 1.0), 0.8).xyz, 1.0);
+    vec3 waterColor = vec3(0, 87.0 / 256, 143.0 / 256);
+    if (useRefraction) {
+        // Distorted lookups that land on something in front of the water fall back
+        // to the straight one; deeper water shows less of the bottom
+        float surface = linear_depth(gl_FragCoord.z);
+        if (linear_depth(texture(refraction_depth, R2).r) < surface) {
+            R2 = ndc;
+        }
+        float thickness = linear_depth(texture(refraction_depth, R2).r) - surface;
+        waterColor = mix(texture(refraction_texture, R2).rgb, waterColor, clamp(thickness / 1.5, 0.3, 1.0));
+    }
+
+    o_frag_color = vec4(result * mix(vec4(texture(reflection_texture, R).rgb + sunSpecular, 1.0), vec4(waterColor, 1.0), 0.8).xyz, 1.0);
     o_frag_color = clamp(o_frag_color, 0.0, 1.0);
 }
@@ -13,12 +13,14 @@ out vec3 aPosition;
 out vec2 aTexCoords;
 out vec4 aClipCoords;
 out vec4 aLightPosition;
+out vec4 aWorldPosition;
 
 void main()
 {
    vec4 pos = vec4(in_position, 1.0);
    aPosition = in_position;
    aTexCoords = texcoords;
-   aClipCoords = projection * view * model * pos;
+   aWorldPosition = model * pos;
+   aClipCoords = projection * view * aWorldPosition;
    gl_Position = aClipCoords;
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "benchmark.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include <fmt/format.h>
+
+#include "render_stats.h"
+
+double MeasureMs(const std::function<void()>& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+BenchmarkResult RunBenchmark(const Benchmark& benchmark) {
+    for (int i = 0; i < benchmark.warmup; i++) {
+        benchmark.run();
+    }
+    std::vector<double> times;
+    for (int i = 0; i < benchmark.repetitions; i++) {
+        times.push_back(benchmark.run());
+    }
+
+    FrameTimeSummary summary = SummarizeFrameTimes(times);
+    BenchmarkResult result;
+    result.name = benchmark.name;
+    result.repetitions = summary.frames;
+    result.mean = summary.average;
+    result.minimum = summary.minimum;
+    result.median = summary.p50;
+    result.p95 = summary.p95;
+    result.maximum = summary.maximum;
+    double variance = 0;
+    for (double time : times) {
+        variance += (time - summary.average) * (time - summary.average);
+    }
+    result.stddev = times.size() > 1 ? std::sqrt(variance / (times.size() - 1)) : 0.0;
+    return result;
+}
+
+bool WriteBenchmarkJson(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Can't write benchmark results to " << path << "\n";
+        return false;
+    }
+    out << "{\"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        out << fmt::format("  {{\"name\": \"{}\", \"repetitions\": {}, \"mean_ms\": {:.4f}, \"stddev_ms\": {:.4f}, "
+                           "\"min_ms\": {:.4f}, \"median_ms\": {:.4f}, \"p95_ms\": {:.4f}, \"max_ms\": {:.4f}}}",
+                           r.name, r.repetitions, r.mean, r.stddev, r.minimum, r.median, r.p95, r.maximum)
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    return true;
+}
+
+bool LoadBenchmarkBaseline(const std::string& path, std::map<std::string, double>& medians) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Can't read benchmark baseline " << path << "\n";
+        return false;
+    }
+    const std::string nameKey = "\"name\": \"";
+    const std::string medianKey = "\"median_ms\": ";
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find(nameKey);
+        size_t median = line.find(medianKey);
+        if (name == std::string::npos || median == std::string::npos) {
+            continue;
+        }
+        name += nameKey.size();
+        medians[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + median + medianKey.size());
+    }
+    return true;
+}
+
+int CompareWithBaseline(const std::vector<BenchmarkResult>& results,
+                        const std::map<std::string, double>& baseline, double tolerance) {
+    int regressions = 0;
+    for (const BenchmarkResult& result : results) {
+        auto found = baseline.find(result.name);
+        if (found == baseline.end()) {
+            std::cout << fmt::format("{:<32} {:10.3f} ms  (not in baseline)\n", result.name, result.median);
+            continue;
+        }
+        double change = found->second > 0 ? result.median / found->second - 1.0 : 0.0;
+        bool regressed = change > tolerance;
+        regressions += regressed;
+        std::cout << fmt::format("{:<32} {:10.3f} ms  baseline {:10.3f} ms  {:+6.1f}%{}\n", result.name,
+                                 result.median, found->second, 100.0 * change, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
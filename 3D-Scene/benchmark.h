@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Minimal benchmark harness for scene-benchmarks: every benchmark runs warmup
+// times unmeasured, then repetitions times measured, and reports the
+// distribution of the measured times.
+struct Benchmark {
+    std::string name;
+    // Returns the milliseconds one repetition took. Micro benchmarks time their
+    // body with MeasureMs; macro ones may report a time measured elsewhere.
+    std::function<double()> run;
+    int warmup = 2;
+    int repetitions = 10;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    int repetitions = 0;
+    double mean = 0;
+    double stddev = 0;
+    double minimum = 0;
+    double median = 0;
+    double p95 = 0;
+    double maximum = 0;
+};
+
+double MeasureMs(const std::function<void()>& body);
+
+BenchmarkResult RunBenchmark(const Benchmark& benchmark);
+
+// One object per benchmark, one per line, so baselines diff cleanly
+bool WriteBenchmarkJson(const std::string& path, const std::vector<BenchmarkResult>& results);
+
+// Median milliseconds by benchmark name from a file written by WriteBenchmarkJson
+bool LoadBenchmarkBaseline(const std::string& path, std::map<std::string, double>& medians);
+
+// Prints every benchmark against the baseline and returns the number whose
+// median grew by more than tolerance (0.1 = 10%)
+int CompareWithBaseline(const std::vector<BenchmarkResult>& results,
+                        const std::map<std::string, double>& baseline, double tolerance);
@@ -0,0 +1,90 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    const char kMagic[4] = {'C', 'P', 'T', 'H'};
+    const uint32_t kVersion = 1;
+}
+
+int AdvanceAnimationClock(AnimationClock& clock, double elapsed) {
+    clock.accumulator += elapsed;
+    int steps = (int) std::floor(clock.accumulator / kAnimationStep);
+    clock.accumulator -= steps * kAnimationStep;
+    return std::min(steps, clock.maxStepsPerFrame);
+}
+
+bool SaveCameraPath(const CameraPath& path, const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Can't write camera path to " << filename << "\n";
+        return false;
+    }
+    uint32_t count = (uint32_t) path.samples.size();
+    file.write(kMagic, sizeof(kMagic));
+    file.write((const char*) &kVersion, sizeof(kVersion));
+    file.write((const char*) &path.step, sizeof(path.step));
+    file.write((const char*) &count, sizeof(count));
+    for (const CameraSample& sample : path.samples) {
+        float values[6] = {sample.position.x, sample.position.y, sample.position.z,
+                           sample.direction.x, sample.direction.y, sample.direction.z};
+        file.write((const char*) values, sizeof(values));
+    }
+    return (bool) file;
+}
+
+bool LoadCameraPath(CameraPath& path, const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Can't read camera path " << filename << "\n";
+        return false;
+    }
+    char magic[4];
+    uint32_t version = 0;
+    float step = 0;
+    uint32_t count = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*) &version, sizeof(version));
+    file.read((char*) &step, sizeof(step));
+    file.read((char*) &count, sizeof(count));
+    if (!file || std::memcmp(magic, kMagic, sizeof(magic)) != 0 || version != kVersion) {
+        std::cerr << filename << " is not a camera path\n";
+        return false;
+    }
+    // Samples are one animation step apart; a path recorded at another rate
+    // would replay at the wrong speed
+    if (step != (float) kAnimationStep) {
+        std::cerr << "Camera path " << filename << " was recorded with a step of " << step
+                  << " s, not " << (float) kAnimationStep << " s\n";
+        return false;
+    }
+
+    // Checked before allocating, so a corrupt count can't ask for gigabytes
+    std::streamoff header = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    file.seekg(header);
+    if ((uint64_t) count * 6 * sizeof(float) > (uint64_t) (size - header)) {
+        std::cerr << "Camera path " << filename << " is truncated\n";
+        return false;
+    }
+
+    path.step = step;
+    path.samples.resize(count);
+    for (CameraSample& sample : path.samples) {
+        float values[6];
+        file.read((char*) values, sizeof(values));
+        sample.position = glm::vec3(values[0], values[1], values[2]);
+        sample.direction = glm::vec3(values[3], values[4], values[5]);
+    }
+    if (!file) {
+        std::cerr << "Camera path " << filename << " is truncated\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// The scene advances in fixed steps: live, as many steps as real time has passed;
+// when playing a camera path or headless, exactly one step per frame, so every
+// run renders the same frames however long they take.
+const double kAnimationStep = 1.0 / 60.0;
+
+struct AnimationClock {
+    double accumulator = 0;     // seconds not yet turned into steps
+    long long step = 0;         // steps taken so far, counted by the caller
+    int maxStepsPerFrame = 8;   // after a hitch the scene jumps rather than spirals
+};
+
+// Returns the number of steps due after elapsed seconds of real time
+int AdvanceAnimationClock(AnimationClock& clock, double elapsed);
+
+// Camera state at every step
+struct CameraSample {
+    glm::vec3 position;
+    glm::vec3 direction;
+};
+
+struct CameraPath {
+    float step = (float) kAnimationStep;
+    std::vector<CameraSample> samples;
+};
+
+// Binary: "CPTH", version, step length, sample count, then six floats per sample.
+// Both print the reason and return false on failure.
+bool SaveCameraPath(const CameraPath& path, const std::string& filename);
+bool LoadCameraPath(CameraPath& path, const std::string& filename);
@@ -0,0 +1,143 @@
+#include "depth_reduction.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "model.h"
+#include "render_stats.h"
+
+void CreateDepthReduction(DepthReduction& reduction, int width, int height) {
+    reduction.width = width;
+    reduction.height = height;
+    reduction.valid = false;
+
+    glm::ivec2 size(width, height);
+    do {
+        size = glm::ivec2(std::max(1, (size.x + 1) / 2), std::max(1, (size.y + 1) / 2));
+
+        unsigned int frameBuffer = CreateFrameBuffer();
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size.x, size.y, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Depth reduction framebuffer is incomplete" << std::endl;
+            exit(1);
+        }
+
+        reduction.frameBuffers.push_back(frameBuffer);
+        reduction.textures.push_back(texture);
+        reduction.sizes.push_back(size);
+    } while (size.x > 1 || size.y > 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenVertexArrays(1, &reduction.vao);
+
+    glGenBuffers(DepthReduction::kReadbackSlots, reduction.pixelBuffers);
+    for (int i = 0; i < DepthReduction::kReadbackSlots; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, reduction.pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 2 * sizeof(float), NULL, GL_STREAM_READ);
+        reduction.fences[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    reduction.nextSlot = 0;
+}
+
+void DeleteDepthReduction(DepthReduction& reduction) {
+    glDeleteFramebuffers((GLsizei) reduction.frameBuffers.size(), reduction.frameBuffers.data());
+    glDeleteTextures((GLsizei) reduction.textures.size(), reduction.textures.data());
+    glDeleteVertexArrays(1, &reduction.vao);
+    glDeleteBuffers(DepthReduction::kReadbackSlots, reduction.pixelBuffers);
+    for (int i = 0; i < DepthReduction::kReadbackSlots; i++) {
+        if (reduction.fences[i]) {
+            glDeleteSync(reduction.fences[i]);
+            reduction.fences[i] = 0;
+        }
+    }
+    reduction.frameBuffers.clear();
+    reduction.textures.clear();
+    reduction.sizes.clear();
+    reduction.valid = false;
+}
+
+void ReduceDepth(DepthReduction& reduction, shader_t& initShader, shader_t& reduceShader,
+                 unsigned int depthTexture, float nearPlane, float farPlane, float maxDepth) {
+    // Every slot still in flight: skip this frame rather than stall on the oldest
+    int slot = reduction.nextSlot;
+    if (reduction.fences[slot]) {
+        return;
+    }
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(reduction.vao);
+    glActiveTexture(GL_TEXTURE0);
+
+    for (size_t level = 0; level < reduction.textures.size(); level++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, reduction.frameBuffers[level]);
+        CountFrameBufferBind();
+        glViewport(0, 0, reduction.sizes[level].x, reduction.sizes[level].y);
+
+        if (level == 0) {
+            initShader.use();
+            initShader.set_uniform("depthTexture", 0);
+            initShader.set_uniform("nearPlane", nearPlane);
+            initShader.set_uniform("farPlane", farPlane);
+            initShader.set_uniform("maxDepth", maxDepth);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+        } else {
+            reduceShader.use();
+            reduceShader.set_uniform("rangeTexture", 0);
+            glBindTexture(GL_TEXTURE_2D, reduction.textures[level - 1]);
+        }
+        CountDraw(1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, reduction.pixelBuffers[slot]);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, 1, 1, GL_RG, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    reduction.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    reduction.nextSlot = (slot + 1) % DepthReduction::kReadbackSlots;
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CountFrameBufferBind();
+    glEnable(GL_DEPTH_TEST);
+}
+
+bool PollDepthReduction(DepthReduction& reduction) {
+    bool updated = false;
+    // Slots complete in submission order, starting from the one after the newest
+    for (int k = 0; k < DepthReduction::kReadbackSlots; k++) {
+        int slot = (reduction.nextSlot + k) % DepthReduction::kReadbackSlots;
+        if (!reduction.fences[slot]) {
+            continue;
+        }
+        GLenum status = glClientWaitSync(reduction.fences[slot], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(reduction.fences[slot]);
+        reduction.fences[slot] = 0;
+
+        float range[2];
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, reduction.pixelBuffers[slot]);
+        glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(range), range);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // An empty reduction (only sky on screen) leaves min above max
+        reduction.valid = range[0] <= range[1];
+        if (reduction.valid) {
+            reduction.result = glm::vec2(range[0], range[1]);
+        }
+        updated = true;
+    }
+    return updated;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "opengl_shader.h"
+
+// Min/max view depth of the visible pixels, for fitting shadow cascades to what
+// is on screen. The depth buffer is reduced on the GPU through a chain of RG32F
+// render targets, each half the size of the previous one, and the final texel
+// is read back through pixel buffers a few frames later so the CPU never waits.
+struct DepthReduction {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned int> frameBuffers;
+    std::vector<unsigned int> textures;
+    std::vector<glm::ivec2> sizes;
+    unsigned int vao = 0;
+
+    static const int kReadbackSlots = 3;
+    unsigned int pixelBuffers[kReadbackSlots] = {};
+    GLsync fences[kReadbackSlots] = {};
+    int nextSlot = 0;
+
+    bool valid = false;    // result holds a finished reduction with visible pixels
+    glm::vec2 result;      // min and max view depth
+};
+
+void CreateDepthReduction(DepthReduction& reduction, int width, int height);
+void DeleteDepthReduction(DepthReduction& reduction);
+
+// Queues the reduction of depthTexture (width x height, perspective depth with the
+// given planes). Depths at or beyond maxDepth are ignored. Changes the bound
+// framebuffer and viewport.
+void ReduceDepth(DepthReduction& reduction, shader_t& initShader, shader_t& reduceShader,
+                 unsigned int depthTexture, float nearPlane, float farPlane, float maxDepth);
+
+// Picks up the oldest queued reduction if the GPU has finished it; true when
+// result was updated.
+bool PollDepthReduction(DepthReduction& reduction);
@@ -0,0 +1,49 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool UpdateDynamicResolution(DynamicResolution& resolution, float gpuMs) {
+    resolution.framesSinceChange++;
+    if (!resolution.enabled || gpuMs <= 0) {
+        return false;
+    }
+    resolution.smoothedMs = resolution.smoothedMs > 0
+                            ? resolution.smoothedMs + resolution.smoothing * (gpuMs - resolution.smoothedMs)
+                            : gpuMs;
+    if (resolution.framesSinceChange < resolution.cooldownFrames) {
+        return false;
+    }
+    float lower = resolution.lowerBand * resolution.targetMs;
+    if (resolution.smoothedMs >= lower && resolution.smoothedMs <= resolution.targetMs) {
+        return false;
+    }
+
+    // Aim for the middle of the band, taking the GPU time to follow the pixel
+    // count; the passes that don't scale make this optimistic, later changes
+    // correct it
+    float aim = 0.5f * (lower + resolution.targetMs);
+    float wanted = resolution.scale * std::sqrt(aim / resolution.smoothedMs);
+    wanted = std::min(wanted, resolution.scale + resolution.maxIncrease);
+    wanted = resolution.scaleStep * std::round(wanted / resolution.scaleStep);
+    // Out of the band always moves at least one step
+    if (resolution.smoothedMs > resolution.targetMs) {
+        wanted = std::min(wanted, resolution.scale - resolution.scaleStep);
+    } else {
+        wanted = std::max(wanted, resolution.scale + resolution.scaleStep);
+    }
+    wanted = std::max(resolution.minScale, std::min(resolution.maxScale, wanted));
+    if (std::abs(wanted - resolution.scale) < 0.5f * resolution.scaleStep) {
+        return false;
+    }
+    resolution.scale = wanted;
+    resolution.framesSinceChange = 0;
+    resolution.smoothedMs = 0;
+    return true;
+}
+
+void DynamicResolutionSize(const DynamicResolution& resolution, int displayWidth, int displayHeight,
+                           int& width, int& height) {
+    width = std::max(1, (int) std::lround(displayWidth * resolution.scale));
+    height = std::max(1, (int) std::lround(displayHeight * resolution.scale));
+}
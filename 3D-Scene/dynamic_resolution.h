@@ -0,0 +1,31 @@
+#pragma once
+
+// Scales the main pass, and the reflection with it, to keep the GPU frame time
+// near a budget; the presented frame is upscaled to the window. The measured
+// time is smoothed and the scale only moves once it leaves the band between
+// lowerBand * targetMs and targetMs. After a change the controller waits
+// cooldownFrames so the timer queries catch up with the new size. While
+// disabled, scale stays wherever it was set.
+struct DynamicResolution {
+    bool enabled = false;
+    float targetMs = 16.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float lowerBand = 0.75f;
+    float smoothing = 0.1f;         // weight of the newest frame in smoothedMs
+    int cooldownFrames = 20;
+    float scaleStep = 0.05f;        // scales are multiples of this so targets are reallocated rarely
+    float maxIncrease = 0.1f;       // per change; decreases aren't limited
+
+    float scale = 1.0f;             // of each axis
+    float smoothedMs = 0;
+    int framesSinceChange = 0;
+};
+
+// Feeds one frame's GPU time (0 while there is none) and returns true when the
+// scale changed
+bool UpdateDynamicResolution(DynamicResolution& resolution, float gpuMs);
+
+// Main pass size for the given window size at the current scale, at least 1x1
+void DynamicResolutionSize(const DynamicResolution& resolution, int displayWidth, int displayHeight,
+                           int& width, int& height);
@@ -0,0 +1,189 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "imgui.h"
+
+namespace {
+    void Record(std::vector<float>& history, int& next, int& count, int historySize, float value) {
+        if ((int) history.size() != historySize) {
+            history.assign(historySize, 0.0f);
+            next = 0;
+            count = 0;
+        }
+        history[next] = value;
+        next = (next + 1) % historySize;
+        count = std::min(count + 1, historySize);
+    }
+
+    ProfilerStats Stats(const std::vector<float>& history, int count) {
+        ProfilerStats stats;
+        stats.samples = count;
+        if (count == 0) {
+            return stats;
+        }
+        stats.minimum = history[0];
+        stats.maximum = history[0];
+        float sum = 0;
+        for (int i = 0; i < count; i++) {
+            sum += history[i];
+            stats.minimum = std::min(stats.minimum, history[i]);
+            stats.maximum = std::max(stats.maximum, history[i]);
+        }
+        stats.average = sum / count;
+        return stats;
+    }
+
+    // Zones that haven't run for this many frames are culled passes or switched-off
+    // features; the table hides them
+    const int kStaleFrames = 30;
+}
+
+void BeginProfilerFrame(GpuProfiler& profiler) {
+    profiler.frame++;
+    for (ProfilerZone& zone : profiler.zones) {
+        for (int slot = 0; slot < ProfilerZone::kQuerySlots; slot++) {
+            if (!zone.pending[slot]) {
+                continue;
+            }
+            GLint available = 0;
+            glGetQueryObjectiv(zone.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                continue;
+            }
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(zone.queries[slot], GL_QUERY_RESULT, &elapsed);
+            zone.pending[slot] = false;
+            Record(zone.gpuMs, zone.gpuNext, zone.gpuCount, profiler.historySize, elapsed / 1e6f);
+        }
+    }
+}
+
+void BeginProfilerZone(GpuProfiler& profiler, const std::string& name) {
+    if (!profiler.enabled) {
+        return;
+    }
+
+    auto found = profiler.zoneIndex.find(name);
+    int index;
+    if (found == profiler.zoneIndex.end()) {
+        ProfilerZone zone;
+        zone.name = name;
+        glGenQueries(ProfilerZone::kQuerySlots, zone.queries);
+        profiler.zones.push_back(zone);
+        index = (int) profiler.zones.size() - 1;
+        profiler.zoneIndex[name] = index;
+    } else {
+        index = found->second;
+    }
+
+    ProfilerZone& zone = profiler.zones[index];
+    profiler.openZone = index;
+    zone.lastFrame = profiler.frame;
+    zone.slot = -1;
+    for (int slot = 0; slot < ProfilerZone::kQuerySlots; slot++) {
+        if (!zone.pending[slot]) {
+            zone.slot = slot;
+            break;
+        }
+    }
+    if (zone.slot >= 0) {
+        glBeginQuery(GL_TIME_ELAPSED, zone.queries[zone.slot]);
+    }
+    zone.cpuStart = std::chrono::steady_clock::now();
+}
+
+void EndProfilerZone(GpuProfiler& profiler) {
+    if (profiler.openZone < 0) {
+        return;
+    }
+    ProfilerZone& zone = profiler.zones[profiler.openZone];
+    profiler.openZone = -1;
+
+    float cpu = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - zone.cpuStart).count();
+    Record(zone.cpuMs, zone.cpuNext, zone.cpuCount, profiler.historySize, cpu);
+    if (zone.slot >= 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+        zone.pending[zone.slot] = true;
+    }
+}
+
+ProfilerStats ProfilerGpuStats(const ProfilerZone& zone) {
+    return Stats(zone.gpuMs, zone.gpuCount);
+}
+
+ProfilerStats ProfilerCpuStats(const ProfilerZone& zone) {
+    return Stats(zone.cpuMs, zone.cpuCount);
+}
+
+float ProfilerFrameGpuMs(const GpuProfiler& profiler) {
+    if (!profiler.enabled) {
+        return 0;
+    }
+    float total = 0;
+    for (const ProfilerZone& zone : profiler.zones) {
+        if (profiler.frame - zone.lastFrame > ProfilerZone::kQuerySlots || zone.gpuCount == 0) {
+            continue;
+        }
+        int newest = (zone.gpuNext + (int) zone.gpuMs.size() - 1) % (int) zone.gpuMs.size();
+        total += zone.gpuMs[newest];
+    }
+    return total;
+}
+
+void DrawProfilerWindow(GpuProfiler& profiler) {
+    ImGui::Begin("Profiler");
+    ImGui::Checkbox("Enabled", &profiler.enabled);
+    ImGui::SameLine();
+    ImGui::Text("ms over the last %d frames", profiler.historySize);
+    ImGui::Separator();
+
+    ImGui::Columns(7, "zones");
+    for (const char* title : {"zone", "gpu avg", "gpu min", "gpu max", "cpu avg", "cpu min", "cpu max"}) {
+        ImGui::Text("%s", title);
+        ImGui::NextColumn();
+    }
+    ImGui::Separator();
+
+    float gpuTotal = 0;
+    float cpuTotal = 0;
+    for (const ProfilerZone& zone : profiler.zones) {
+        if (profiler.frame - zone.lastFrame > kStaleFrames) {
+            continue;
+        }
+        ProfilerStats gpu = ProfilerGpuStats(zone);
+        ProfilerStats cpu = ProfilerCpuStats(zone);
+        gpuTotal += gpu.average;
+        cpuTotal += cpu.average;
+
+        ImGui::Text("%s", zone.name.c_str());
+        ImGui::NextColumn();
+        for (float value : {gpu.average, gpu.minimum, gpu.maximum, cpu.average, cpu.minimum, cpu.maximum}) {
+            ImGui::Text("%.3f", value);
+            ImGui::NextColumn();
+        }
+    }
+    ImGui::Separator();
+    ImGui::Text("total");
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", gpuTotal);
+    ImGui::NextColumn();
+    ImGui::NextColumn();
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", cpuTotal);
+    ImGui::NextColumn();
+    ImGui::NextColumn();
+    ImGui::NextColumn();
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+void DeleteGpuProfiler(GpuProfiler& profiler) {
+    for (ProfilerZone& zone : profiler.zones) {
+        glDeleteQueries(ProfilerZone::kQuerySlots, zone.queries);
+    }
+    profiler.zones.clear();
+    profiler.zoneIndex.clear();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+// Per-pass GPU and CPU timings. Each zone owns a small ring of GL_TIME_ELAPSED
+// queries; a query is only read once GL_QUERY_RESULT_AVAILABLE says so, and a
+// zone whose ring is still busy skips that frame's sample, so the CPU never
+// waits on the GPU. CPU time is what it takes to submit the zone's commands.
+// Zones can't nest (GL_TIME_ELAPSED queries can't overlap).
+struct ProfilerZone {
+    std::string name;
+
+    static const int kQuerySlots = 3;
+    unsigned int queries[kQuerySlots] = {};
+    bool pending[kQuerySlots] = {};
+    int slot = -1;                          // slot of the running query, -1 when skipped
+
+    std::vector<float> gpuMs;               // rolling history, historySize entries
+    std::vector<float> cpuMs;
+    int gpuNext = 0;
+    int gpuCount = 0;
+    int cpuNext = 0;
+    int cpuCount = 0;
+
+    std::chrono::steady_clock::time_point cpuStart;
+    long long lastFrame = -1;               // last frame the zone ran
+};
+
+struct GpuProfiler {
+    bool enabled = true;
+    int historySize = 120;
+
+    long long frame = 0;
+    std::vector<ProfilerZone> zones;        // in order of first use
+    std::map<std::string, int> zoneIndex;
+    int openZone = -1;
+};
+
+// Collects the finished queries; call once at the start of every frame.
+void BeginProfilerFrame(GpuProfiler& profiler);
+
+void BeginProfilerZone(GpuProfiler& profiler, const std::string& name);
+void EndProfilerZone(GpuProfiler& profiler);
+
+struct ProfilerStats {
+    float average = 0;
+    float minimum = 0;
+    float maximum = 0;
+    int samples = 0;
+};
+
+ProfilerStats ProfilerGpuStats(const ProfilerZone& zone);
+ProfilerStats ProfilerCpuStats(const ProfilerZone& zone);
+
+// Sum of the newest GPU samples of the zones that ran in the last few frames:
+// a frame's GPU time, a frame or two late. 0 while disabled or before results
+// come in.
+float ProfilerFrameGpuMs(const GpuProfiler& profiler);
+
+// Table of the zones that ran recently, with rolling average, minimum and maximum
+void DrawProfilerWindow(GpuProfiler& profiler);
+
+void DeleteGpuProfiler(GpuProfiler& profiler);
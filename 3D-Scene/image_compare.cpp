@@ -0,0 +1,139 @@
+#include "image_compare.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+
+namespace {
+    // Skips whitespace and # comments between PPM header fields
+    bool ReadHeaderValue(FILE* file, int& value) {
+        int c = fgetc(file);
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#') {
+                while (c != '\n' && c != EOF) {
+                    c = fgetc(file);
+                }
+            }
+            c = fgetc(file);
+        }
+        ungetc(c, file);
+        return fscanf(file, "%d", &value) == 1;
+    }
+
+    std::vector<float> Luma(const Image& image) {
+        std::vector<float> luma(image.width * image.height);
+        for (size_t i = 0; i < luma.size(); i++) {
+            const unsigned char* p = &image.pixels[3 * i];
+            luma[i] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+        }
+        return luma;
+    }
+
+    // Mean SSIM over 8x8 windows every 4 pixels, with the usual constants for 8-bit data
+    double Ssim(const std::vector<float>& a, const std::vector<float>& b, int width, int height) {
+        const int window = 8;
+        const int stride = 4;
+        const double c1 = (0.01 * 255) * (0.01 * 255);
+        const double c2 = (0.03 * 255) * (0.03 * 255);
+        double total = 0;
+        int windows = 0;
+        for (int y = 0; y + window <= height; y += stride) {
+            for (int x = 0; x + window <= width; x += stride) {
+                double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+                for (int j = y; j < y + window; j++) {
+                    for (int i = x; i < x + window; i++) {
+                        double va = a[j * width + i];
+                        double vb = b[j * width + i];
+                        sumA += va;
+                        sumB += vb;
+                        sumAA += va * va;
+                        sumBB += vb * vb;
+                        sumAB += va * vb;
+                    }
+                }
+                const double n = window * window;
+                double meanA = sumA / n;
+                double meanB = sumB / n;
+                double varianceA = sumAA / n - meanA * meanA;
+                double varianceB = sumBB / n - meanB * meanB;
+                double covariance = sumAB / n - meanA * meanB;
+                total += (2 * meanA * meanB + c1) * (2 * covariance + c2)
+                         / ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+                windows++;
+            }
+        }
+        return windows > 0 ? total / windows : 1.0;
+    }
+}
+
+bool LoadPpm(Image& image, const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Can't read image " << path << "\n";
+        return false;
+    }
+    char magic[2] = {};
+    int maxValue = 0;
+    bool valid = fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && magic[1] == '6'
+                 && ReadHeaderValue(file, image.width) && ReadHeaderValue(file, image.height)
+                 && ReadHeaderValue(file, maxValue) && maxValue == 255
+                 && image.width > 0 && image.height > 0;
+    if (valid) {
+        fgetc(file);    // the single whitespace before the pixels
+        image.pixels.resize(3 * image.width * image.height);
+        valid = fread(image.pixels.data(), 1, image.pixels.size(), file) == image.pixels.size();
+    }
+    fclose(file);
+    if (!valid) {
+        std::cerr << path << " is not an 8-bit binary PPM\n";
+        return false;
+    }
+    return true;
+}
+
+bool SavePpm(const Image& image, const std::string& path) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Can't write image to " << path << "\n";
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    fwrite(image.pixels.data(), 1, image.pixels.size(), file);
+    fclose(file);
+    return true;
+}
+
+bool CompareImages(const Image& reference, const Image& image, ImageComparison& comparison, Image& diff) {
+    if (reference.width != image.width || reference.height != image.height) {
+        std::cerr << "Image is " << image.width << "x" << image.height << ", the reference "
+                  << reference.width << "x" << reference.height << "\n";
+        return false;
+    }
+
+    diff.width = image.width;
+    diff.height = image.height;
+    diff.pixels.resize(image.pixels.size());
+    double squaredError = 0;
+    int different = 0;
+    comparison.maxDifference = 0;
+    for (size_t i = 0; i < image.pixels.size(); i += 3) {
+        int pixelDifference = 0;
+        for (int c = 0; c < 3; c++) {
+            int difference = std::abs((int) image.pixels[i + c] - (int) reference.pixels[i + c]);
+            squaredError += difference * difference;
+            pixelDifference = std::max(pixelDifference, difference);
+            diff.pixels[i + c] = (unsigned char) std::min(255, 8 * difference);
+        }
+        comparison.maxDifference = std::max(comparison.maxDifference, pixelDifference);
+        different += pixelDifference > 8;
+    }
+    double mse = squaredError / image.pixels.size();
+    comparison.psnr = mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    comparison.differentPixels = image.pixels.empty() ? 0.0 : (double) different / (image.pixels.size() / 3);
+    comparison.ssim = Ssim(Luma(reference), Luma(image), image.width, image.height);
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// 8-bit RGB, rows top to bottom
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// Binary PPM (P6, maxval 255) as SaveAppFrame writes. Both print the reason and
+// return false on failure.
+bool LoadPpm(Image& image, const std::string& path);
+bool SavePpm(const Image& image, const std::string& path);
+
+struct ImageComparison {
+    double psnr = 0;            // dB over RGB, infinite for identical images
+    double ssim = 0;            // mean SSIM of the luma, 1 for identical images
+    int maxDifference = 0;      // largest difference of any channel
+    double differentPixels = 0; // fraction of pixels off by more than 8 in some channel
+};
+
+// Compares two images of the same size and fills diff with the per-pixel
+// difference, amplified so small errors show
+bool CompareImages(const Image& reference, const Image& image, ImageComparison& comparison, Image& diff);
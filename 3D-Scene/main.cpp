@@ -23,6 +23,19 @@
 
 #include "opengl_shader.h"
 #include "model.h"
+#include "terrain_generator.h"
+#include "terrain_raycast.h"
+#include "terrain_horizon.h"
+#include "terrain_clipmap.h"
+#include "shadows.h"
+#include "depth_reduction.h"
+#include "render_graph.h"
+#include "gpu_profiler.h"
+#include "trace.h"
+#include "render_stats.h"
+#include "app_context.h"
+#include "camera_path.h"
+#include "dynamic_resolution.h"
 
 #include "3rd-party/stb_image.h"
 
@@ -37,68 +50,162 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 unsigned int reflectionFrameBuffer;
 unsigned int reflectionTexture;
 unsigned int reflectionDepthBuffer;
-unsigned int refractionFrameBuffer;
-unsigned int refractionTexture;
-unsigned int refractionDepthTexture;
 
-std::vector<unsigned int> shadowFrameBuffers;
-std::vector<unsigned int> shadowDepthTextures;
+// The reflection is sized relative to the main pass, see reflectionScale
+int reflectionWidth = 0;
+int reflectionHeight = 0;
 
-const int REFLECTION_WIDTH = 1280;
-const int REFLECTION_HEIGHT = 720;
-
-const int REFRACTION_WIDTH = 1280;
-const int REFRACTION_HEIGHT = 720;
+// The main pass renders here so its depth can be read back, then is blitted to the
+// window; smaller than the window while dynamic resolution scales it down
+unsigned int sceneFrameBuffer;
+unsigned int sceneTexture;
+unsigned int sceneDepthTexture;
+int sceneWidth = 0;
+int sceneHeight = 0;
 
 
 void CleanUp() {
     glDeleteFramebuffers(1, &reflectionFrameBuffer);
     glDeleteTextures(1, &reflectionTexture);
     glDeleteRenderbuffers(1, &reflectionDepthBuffer);
-    glDeleteFramebuffers(1, &refractionFrameBuffer);
-    glDeleteTextures(1, &refractionTexture);
-    glDeleteTextures(1, &refractionDepthTexture);
+    glDeleteFramebuffers(1, &sceneFrameBuffer);
+    glDeleteTextures(1, &sceneTexture);
+    glDeleteTextures(1, &sceneDepthTexture);
 }
 
-void InitReflectionFrameBuffer() {
+void InitReflectionFrameBuffer(int width, int height) {
+    if (reflectionWidth != 0) {
+        glDeleteFramebuffers(1, &reflectionFrameBuffer);
+        glDeleteTextures(1, &reflectionTexture);
+        glDeleteRenderbuffers(1, &reflectionDepthBuffer);
+    }
+    reflectionWidth = width;
+    reflectionHeight = height;
+
     reflectionFrameBuffer = CreateFrameBuffer();
-    reflectionTexture = CreateTextureAttachment(REFLECTION_HEIGHT, REFLECTION_WIDTH);
-    reflectionDepthBuffer = CreateDepthBufferAttachment(REFLECTION_HEIGHT, REFLECTION_WIDTH);
+    reflectionTexture = CreateTextureAttachment(height, width);
+    reflectionDepthBuffer = CreateDepthBufferAttachment(height, width);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void InitRefractionFrameBuffer() {
-    refractionFrameBuffer = CreateFrameBuffer();
-    refractionTexture = CreateTextureAttachment(REFRACTION_HEIGHT, REFRACTION_WIDTH);
-    refractionDepthTexture = CreateDepthTextureAttachment(REFRACTION_HEIGHT, REFRACTION_WIDTH);
+void InitSceneFrameBuffer(int width, int height) {
+    if (sceneWidth != 0) {
+        glDeleteFramebuffers(1, &sceneFrameBuffer);
+        glDeleteTextures(1, &sceneTexture);
+        glDeleteTextures(1, &sceneDepthTexture);
+    }
+    sceneWidth = width;
+    sceneHeight = height;
+
+    sceneFrameBuffer = CreateFrameBuffer();
+    sceneTexture = CreateTextureAttachment(height, width);
+    sceneDepthTexture = CreateDepthTextureAttachment(height, width);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Scene framebuffer is incomplete" << std::endl;
+        exit(1);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 
-int main(int, char **) {
-    // Use GLFW to create a simple window
-    glfwSetErrorCallback(glfw_error_callback);
-    if (!glfwInit())
-        return 1;
+int main(int argc, char **argv) {
+    // Optional procedural terrain instead of the bundled heightmap:
+    //   --terrain-size N --terrain-seed S
+    // and a CPU trace written on exit (builds with SCENE_TRACE), per-frame API call counts:
+    //   --trace FILE --stats-csv FILE
+    // Headless runs render a fixed number of frames offscreen without vsync, print
+    // a frame time summary and optionally dump every n-th frame, from frame
+    // OFFSET on, as PPM:
+    //   --headless FRAMES --width W --height H --dump-frames DIR --dump-interval N --dump-offset OFFSET
+    // Camera paths, recorded from live input on exit or played back one step per
+    // frame (playback ends with the path and prints a frame time summary):
+    //   --record-path FILE --play-path FILE
+    // Performance and quality settings otherwise set in the GUI, e.g. for
+    // scene-golden (names are listed where the overrides are applied):
+    //   --set NAME=VALUE
+    int terrainSize = 0;
+    unsigned int terrainSeed = 1337;
+    std::string tracePath;
+    std::string statsCsvPath;
+    AppContextSettings appSettings;
+    int headlessFrames = 0;
+    std::string dumpDirectory;
+    int dumpInterval = 1;
+    int dumpOffset = 0;
+    std::string recordPathFile;
+    std::string playPathFile;
+    std::vector<std::pair<std::string, std::string>> settings;
+    for (int i = 1; i < argc; i += 2) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << arg << " needs a value\n";
+            return 1;
+        }
+        if (arg == "--terrain-size") {
+            terrainSize = std::atoi(argv[i + 1]);
+        } else if (arg == "--terrain-seed") {
+            terrainSeed = (unsigned int) std::strtoul(argv[i + 1], nullptr, 10);
+        } else if (arg == "--trace") {
+            tracePath = argv[i + 1];
+        } else if (arg == "--stats-csv") {
+            statsCsvPath = argv[i + 1];
+        } else if (arg == "--headless") {
+            appSettings.headless = true;
+            appSettings.vsync = false;
+            headlessFrames = std::atoi(argv[i + 1]);
+        } else if (arg == "--width") {
+            appSettings.width = std::atoi(argv[i + 1]);
+        } else if (arg == "--height") {
+            appSettings.height = std::atoi(argv[i + 1]);
+        } else if (arg == "--dump-frames") {
+            dumpDirectory = argv[i + 1];
+        } else if (arg == "--dump-interval") {
+            dumpInterval = std::max(1, std::atoi(argv[i + 1]));
+        } else if (arg == "--dump-offset") {
+            dumpOffset = std::max(0, std::atoi(argv[i + 1]));
+        } else if (arg == "--set") {
+            std::string setting = argv[i + 1];
+            size_t equals = setting.find('=');
+            if (equals == std::string::npos) {
+                std::cerr << "--set needs NAME=VALUE, got " << setting << "\n";
+                return 1;
+            }
+            settings.emplace_back(setting.substr(0, equals), setting.substr(equals + 1));
+        } else if (arg == "--record-path") {
+            recordPathFile = argv[i + 1];
+        } else if (arg == "--play-path") {
+            playPathFile = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
 
-    // GL 3.3 + GLSL 330
-    const char *glsl_version = "#version 330";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // 3.0+ only
-
-    // Create window with graphics context
-    GLFWwindow *window = glfwCreateWindow(1280, 720, "Dear ImGui - Conan", NULL, NULL);
-    if (window == NULL)
+    CameraPath cameraPath;
+    bool recordingPath = !recordPathFile.empty();
+    bool playingPath = !playPathFile.empty();
+    if (playingPath && !LoadCameraPath(cameraPath, playPathFile)) {
+        return 1;
+    }
+    if (playingPath && recordingPath) {
+        std::cerr << "Can't record and play a camera path at once\n";
         return 1;
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSwapInterval(1); // Enable vsync
+    }
+    if (appSettings.headless && headlessFrames <= 0 && !playingPath) {
+        std::cerr << "--headless needs a frame count or a camera path\n";
+        return 1;
+    }
 
-    // Initialize GLEW, i.e. fill all possible function pointers for current OpenGL context
-    if (glewInit() != GLEW_OK) {
-        std::cerr << "Failed to initialize OpenGL loader!\n";
+    // Use GLFW to create a simple window, or render offscreen
+    glfwSetErrorCallback(glfw_error_callback);
+    const char *glsl_version = "#version 330";
+    AppContext app;
+    if (!CreateAppContext(app, appSettings))
         return 1;
+    if (!app.headless) {
+        glfwSetFramebufferSizeCallback(app.window, framebuffer_size_callback);
     }
 
     glEnable(GL_DEPTH_TEST);
@@ -136,17 +243,39 @@ int main(int, char **) {
 
     Landscape landscape;
     float scale = 20;
-    LoadLandscape(landscape, "../assets/terrain_heightmap.jpg",
-                  "../assets/sand_texture.jpg",
-                  "../assets/grass_texture.png",
-                  "../assets/rock_texture.jpg",
-                  1.5,
-                  50,
-                  0.2,
-                  0.5,
-                  scale);
+    if (terrainSize > 0) {
+        TerrainGeneratorSettings terrainSettings;
+        terrainSettings.width = terrainSize;
+        terrainSettings.height = terrainSize;
+        terrainSettings.seed = terrainSeed;
+        std::vector<float> heights;
+        GenerateHeightMap(heights, terrainSettings);
+        CreateLandscape(landscape, heights, terrainSize, terrainSize,
+                        "../assets/sand_texture.jpg",
+                        "../assets/grass_texture.png",
+                        "../assets/rock_texture.jpg",
+                        1.5,
+                        50,
+                        0.2,
+                        0.5,
+                        scale);
+    } else {
+        LoadLandscape(landscape, "../assets/terrain_heightmap.jpg",
+                      "../assets/sand_texture.jpg",
+                      "../assets/grass_texture.png",
+                      "../assets/rock_texture.jpg",
+                      1.5,
+                      50,
+                      0.2,
+                      0.5,
+                      scale);
+    }
     scene.landscape = landscape;
 
+    // Matches the (0, -0.05, 0) offset Scene::DrawScene applies to the landscape
+    HeightPyramid terrainPyramid;
+    BuildHeightPyramid(terrainPyramid, scene.landscape.heightMap, scale, -0.05f);
+
     scene.lighthouse.position = glm::vec3(-14, GetHeight(scene.landscape, 14, 7), -7);
 
 
@@ -156,20 +285,32 @@ int main(int, char **) {
     shader_t simpleShader("simple_shader.vs", "simple_shader.fs");
     shader_t waterShader("water_shader.vs", "water_shader.fs");
     shader_t landscapeShader("landscape_shader.vs", "landscape_shader.fs");
-    shader_t landscapeShaderShadow("landscape_shader.vs", "empty_shader.fs");
-    shader_t modelShaderShadow("model_shader.vs", "empty_shader.fs");
+    shader_t landscapeShaderShadow("landscape_shader.vs", "shadow_cascades.gs", "empty_shader.fs");
+    shader_t modelShaderShadow("model_shader.vs", "shadow_cascades.gs", "empty_shader.fs");
+    shader_t simpleShaderShadow("simple_shader.vs", "shadow_cascades.gs", "empty_shader.fs");
+    shader_t landscapeBakeShader("landscape_shader.vs", "landscape_bake_shader.fs");
+    shader_t depthReduceInitShader("fullscreen.vs", "depth_reduce_init.fs");
+    shader_t depthReduceShader("fullscreen.vs", "depth_reduce.fs");
+    shader_t shadowMomentsShader("fullscreen.vs", "shadow_moments.fs");
     scene.modelShader = modelShader;
     scene.cubemapShader = cubemapShader;
     scene.simpleShader = simpleShader;
     scene.landscapeShader = landscapeShader;
     scene.landscapeShaderShadow = landscapeShaderShadow;
     scene.modelShaderShadow = modelShaderShadow;
+    scene.simpleShaderShadow = simpleShaderShadow;
+    for (shader_t* shader : {&modelShader, &landscapeShader, &landscapeShaderShadow, &modelShaderShadow, &simpleShaderShadow}) {
+        shader->bind_uniform_block("ShadowViews", kShadowViewsBinding);
+    }
 
     // Setup GUI context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO &io = ImGui::GetIO();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    // Headless frames still build the GUI (so its cost stays in the timings) but don't draw it
+    if (!app.headless) {
+        ImGui_ImplGlfw_InitForOpenGL(app.window, true);
+    }
     ImGui_ImplOpenGL3_Init(glsl_version);
     ImGui::StyleColorsDark();
 
@@ -188,6 +329,9 @@ int main(int, char **) {
     float projectorVelocity = 0.04f;
     bool dragging = false;
     bool shouldProcessMouse;
+    float cameraGroundClearance = 0.1f;
+    bool wasMousePressed = false;
+    TerrainHit pickedPoint;
 
     glm::vec3 boatCentre = glm::vec3(-10, 0, -10);
     glm::vec3 boatRadius = glm::vec3(0, 0, 8.4);
@@ -195,6 +339,8 @@ int main(int, char **) {
     glm::vec3 boatStartRadius = boatRadius;
     scene.boat.position = boatCentre + boatStartRadius;
     glm::vec3 boatDir = glm::vec3(1, 0, 0);
+    AnimationClock animationClock;
+    auto lastStepTime = std::chrono::steady_clock::now();
 
     scene.cameraPos = glm::vec3(-14, 1.425, -11.53);
     scene.cameraDir = glm::vec3(-0.516, 0.1, 1.17);
@@ -203,108 +349,283 @@ int main(int, char **) {
     sun.direction = glm::vec4(-1, 0.6, 1, 0.0);
     scene.sun = sun;
 
+    float sunDistance = glm::length(glm::vec3(sun.direction));
+    float sunAzimuth = glm::degrees(glm::atan(sun.direction.z, sun.direction.x));
+    float sunElevation = glm::degrees(glm::asin(sun.direction.y / sunDistance));
+
+    HorizonMap horizonMap;
+    BakeHorizonMap(horizonMap, scene.landscape.heightMap, scale,
+                   glm::normalize(glm::vec2(sun.direction.x, sun.direction.z)));
+    scene.horizonTexture = CreateHorizonTexture(horizonMap);
+    scene.useHorizonMap = true;
+    HorizonBaker horizonBaker(scene.landscape.heightMap, scale);
+    horizonBaker.MarkBaked(horizonMap);
+
+    AlbedoClipmap albedoClipmap;
+    CreateAlbedoClipmap(albedoClipmap, 2048, 8, 32.0f);
+    bool clipmapInReflection = true;
+    bool clipmapInMainPass = false;
+
     Spotlight projector;
     projector.angle = glm::radians(15.0f);
 
     projector.position = scene.lighthouse.position + glm::vec3(0, 0.75, 0);
     projector.direction = glm::vec3(2, -0.5f, 0);
     scene.projector = projector;
+    glm::vec3 projectorStartDirection = projector.direction;
 
     unsigned int cube = LoadCubeVertices(1/64.0f);
     scene.cube = cube;
 
+    // The lighthouse and the boat are drawn under occlusion queries in the main and reflection passes
+    OcclusionCulling occlusion;
+    CreateOcclusionCulling(occlusion);
+    scene.occlusion = &occlusion;
+    ModelBounds(scene.lighthouse, scene.lighthouseBoundsMin, scene.lighthouseBoundsMax);
+    ModelBounds(scene.boat, scene.boatBoundsMin, scene.boatBoundsMax);
+    long long testedMeshes = 0;
+    long long occludedMeshes = 0;
+
     scene.waterLevel = waterLevel;
 
-    InitReflectionFrameBuffer();
-    InitRefractionFrameBuffer();
+    // The water distorts the reflection with water_dudv anyway, so it is rendered
+    // at a fraction of the window size, every reflectionInterval frames and with
+    // a cheaper draw list. In between the water reprojects the last one.
+    float reflectionScale = 0.5f;
+    int reflectionInterval = 2;
+    bool reflectionReducedDraw = true;
+    long long frameIndex = 0;
+    long long lastReflectionFrame = -1;
+    glm::mat4 reflectionViewProjection(1.0f);
+
+    // Off by default so headless runs render the same frames every time
+    DynamicResolution dynamicResolution;
+
+    // What the water pass declares it reads; the render graph culls the passes
+    // producing anything else. The refraction is a copy of the main pass taken
+    // just before the water is drawn, not a scene render of its own.
+    RenderGraph frameGraph;
+    GpuProfiler profiler;
+    RenderStats renderStats;
+    if (!statsCsvPath.empty() && !StartRenderStatsCsv(renderStats, statsCsvPath)) {
+        exit(1);
+    }
+    struct WaterInputs {
+        bool reflection = true;
+        bool refraction = false;
+    } waterInputs;
+
+    std::vector<float> planes;
+    float cascadeSplitLambda = 0.75f;
+
+    // Everything that can cast a shadow; fixes the cascade depth range and how far
+    // shadows need to reach. The boat circles inside the landscape square.
+    glm::vec2 terrainRange = terrainPyramid.levels.empty() ? glm::vec2(0.0f) : terrainPyramid.levels.back()[0];
+    glm::vec3 sceneMin(-scale, terrainRange.x + terrainPyramid.offsetY, -scale);
+    glm::vec3 sceneMax(0.0f, terrainRange.y + terrainPyramid.offsetY, 0.0f);
+    glm::vec3 modelMin, modelMax;
+    ModelBounds(scene.lighthouse, modelMin, modelMax);
+    sceneMax.y = std::max(sceneMax.y, scene.lighthouse.position.y + modelMax.y);
+    ModelBounds(scene.boat, modelMin, modelMax);
+    sceneMin.y = std::min(sceneMin.y, modelMin.y - 0.07f);
+    sceneMax.y = std::max(sceneMax.y, modelMax.y);
+
+    // One atlas for every shadow view: the two near cascades at 1024, the far
+    // cascade at 512. The projector's view only holds the boat, its static
+    // casters come from a cube rendered once around the projector.
+    ShadowMap shadowMap;
+    CreateShadowMap(shadowMap, 2048, 3, {1024, 1024, 512, 256});
+    std::vector<int> cascadeResolutions;
+    for (int i = 0; i < shadowMap.cascades; i++) {
+        cascadeResolutions.push_back(shadowMap.views[i].region.size);
+    }
+    scene.projectorShadowView = shadowMap.cascades;
+    shadowMap.dynamicOnlyMask = 1 << scene.projectorShadowView;
 
-    std::vector<float> planes {
-            0.1, 15.0, 30.0, 200.0
-    };
+    StaticShadowCube projectorShadowCube;
+    CreateStaticShadowCube(projectorShadowCube, 512);
+    scene.projectorShadowCube = projectorShadowCube.depthTexture;
+    scene.projectorShadowNear = projectorShadowCube.nearPlane;
+    scene.projectorShadowFar = projectorShadowCube.farPlane;
+    CascadeSchedule cascadeSchedule;
 
-    std::vector<std::pair<int, int>> resolutions {
-            {2048, 2048},
-            {1024, 1024},
-            {256, 256}
-    };
+    CalculateCascadeSplits(planes, shadowMap.cascades, 0.1f, 200.0f, cascadeSplitLambda);
+    scene.planes = planes;
 
-    for (int i = 0; i < 3; i++) {
-        shadowFrameBuffers.push_back(CreateFrameBuffer());
-        shadowDepthTextures.push_back(CreateDepthTextureAttachment(resolutions[i].second, resolutions[i].first));
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Sample distribution shadow maps: fit the splits to the visible depth range
+    DepthReduction depthReduction;
+    bool fitSplitsToDepth = true;
+
+    // --set overrides, once everything they refer to exists
+    for (const auto& setting : settings) {
+        const std::string& name = setting.first;
+        float value = (float) std::atof(setting.second.c_str());
+        if (name == "horizon-map") {
+            scene.useHorizonMap = value != 0;
+        } else if (name == "clipmap-reflection") {
+            clipmapInReflection = value != 0;
+        } else if (name == "clipmap-main") {
+            clipmapInMainPass = value != 0;
+        } else if (name == "reflection-scale") {
+            reflectionScale = glm::clamp(value, 0.25f, 1.0f);
+        } else if (name == "reflection-interval") {
+            reflectionInterval = std::max(1, (int) value);
+        } else if (name == "reflection-reduced") {
+            reflectionReducedDraw = value != 0;
+        } else if (name == "water-refraction") {
+            waterInputs.refraction = value != 0;
+        } else if (name == "shadow-moments") {
+            shadowMap.useMoments = value != 0;
+        } else if (name == "shadow-blur") {
+            shadowMap.blurRadius = std::min(std::max((int) value, 0), 8);
+        } else if (name == "fit-splits") {
+            fitSplitsToDepth = value != 0;
+        } else if (name == "shadow-cache") {
+            shadowMap.useStaticCache = value != 0;
+        } else if (name == "stagger-cascades") {
+            cascadeSchedule.enabled = value != 0;
+        } else if (name == "dynamic-resolution") {
+            dynamicResolution.enabled = value != 0;
+        } else if (name == "resolution-scale") {
+            dynamicResolution.scale = glm::clamp(value, 0.25f, 1.0f);
+        } else if (name == "resolution-target-ms") {
+            dynamicResolution.targetMs = std::max(1.0f, value);
+        } else if (name == "resolution-min") {
+            dynamicResolution.minScale = glm::clamp(value, 0.25f, 1.0f);
+        } else if (name == "resolution-max") {
+            dynamicResolution.maxScale = glm::clamp(value, 0.25f, 1.0f);
+        } else if (name == "occlusion") {
+            occlusion.enabled = value != 0;
+        } else {
+            std::cerr << "Unknown setting " << name << "\n";
+            exit(1);
+        }
     }
 
-    scene.planes = planes;
+    std::vector<double> frameTimes;
+    auto frameStart = std::chrono::steady_clock::now();
+    lastStepTime = frameStart;
 
-    while (!glfwWindowShouldClose(window)) {
+    TRACE_THREAD("main");
+    while (!AppShouldClose(app)
+           && (!app.headless || headlessFrames <= 0 || (int) frameTimes.size() < headlessFrames)
+           && (!playingPath || animationClock.step < (long long) cameraPath.samples.size())) {
+        TRACE_ZONE("frame");
         // Gui start new frame
         ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
+        if (app.headless) {
+            io.DisplaySize = ImVec2((float) app.width, (float) app.height);
+            io.DeltaTime = 1.0f / 60.0f;
+        } else {
+            ImGui_ImplGlfw_NewFrame();
+        }
         ImGui::NewFrame();
 
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-            scene.cameraPos += scene.cameraDir * cameraVelocity;
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-            glm::mat4 rotationMat(1);
-            rotationMat = glm::rotate(rotationMat, glm::radians(90.0f), glm::vec3(0.0, 1.0, 0.0));
-            glm::vec3 left = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
-            left.y = 0;
-            scene.cameraPos += left * cameraVelocity;
-        }
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-            scene.cameraPos -= scene.cameraDir * cameraVelocity;
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-            glm::mat4 rotationMat(1);
-            rotationMat = glm::rotate(rotationMat, glm::radians(-90.0f), glm::vec3(0.0, 1.0, 0.0));
-            glm::vec3 right = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
-            right.y = 0;
-            scene.cameraPos += right * cameraVelocity;
-        }
-        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-            glm::mat4 rotationMat(1);
-            rotationMat = glm::rotate(rotationMat, cameraVelocity, glm::vec3(0.0, 1.0, 0.0));
-            scene.cameraDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
-        }
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-            glm::mat4 rotationMat(1);
-            rotationMat = glm::rotate(rotationMat, -cameraVelocity, glm::vec3(0.0, 1.0, 0.0));
-            scene.cameraDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
-        }
-        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-            glm::mat4 rotationMat(1);
-            rotationMat = glm::rotate(rotationMat, cameraRotationUpVelocity, glm::cross(scene.cameraDir, glm::vec3(0.0, 1.0, 0.0)));
-            glm::vec3 newDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
-            if (glm::abs(glm::sin(glm::acos(glm::dot(glm::normalize(newDir), glm::vec3(0.0, 1.0, 0.0))))) > 0.1) {
-                scene.cameraDir = newDir;
+        BeginProfilerFrame(profiler);
+        BeginRenderStatsFrame(renderStats);
+        BeginOcclusionFrame(occlusion);
+        testedMeshes += occlusion.testedMeshes;
+        occludedMeshes += occlusion.occludedMeshes;
+
+        // Camera and animation advance in fixed steps, see AnimationClock; headless
+        // runs take one per frame like playback so they render the same frames every time
+        auto now = std::chrono::steady_clock::now();
+        int steps = playingPath || app.headless
+                    ? 1 : AdvanceAnimationClock(animationClock, std::chrono::duration<double>(now - lastStepTime).count());
+        lastStepTime = now;
+        for (int step = 0; step < steps; step++, animationClock.step++) {
+            if (playingPath) {
+                const CameraSample& sample = cameraPath.samples[animationClock.step];
+                scene.cameraPos = sample.position;
+                scene.cameraDir = sample.direction;
+                continue;
             }
-        }
-        if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-            glm::mat4 rotationMat(1);
-            rotationMat = glm::rotate(rotationMat, -cameraRotationUpVelocity, glm::cross(scene.cameraDir, glm::vec3(0.0, 1.0, 0.0)));
-            glm::vec3 newDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
-            if (glm::abs(glm::sin(glm::acos(glm::dot(glm::normalize(newDir), glm::vec3(0.0, 1.0, 0.0))))) > 0.1) {
-                scene.cameraDir = newDir;
+            if (AppKeyPressed(app, GLFW_KEY_W))
+                scene.cameraPos += scene.cameraDir * cameraVelocity;
+            if (AppKeyPressed(app, GLFW_KEY_A)) {
+                glm::mat4 rotationMat(1);
+                rotationMat = glm::rotate(rotationMat, glm::radians(90.0f), glm::vec3(0.0, 1.0, 0.0));
+                glm::vec3 left = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
+                left.y = 0;
+                scene.cameraPos += left * cameraVelocity;
+            }
+            if (AppKeyPressed(app, GLFW_KEY_S))
+                scene.cameraPos -= scene.cameraDir * cameraVelocity;
+            if (AppKeyPressed(app, GLFW_KEY_D)) {
+                glm::mat4 rotationMat(1);
+                rotationMat = glm::rotate(rotationMat, glm::radians(-90.0f), glm::vec3(0.0, 1.0, 0.0));
+                glm::vec3 right = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
+                right.y = 0;
+                scene.cameraPos += right * cameraVelocity;
+            }
+            if (AppKeyPressed(app, GLFW_KEY_LEFT)) {
+                glm::mat4 rotationMat(1);
+                rotationMat = glm::rotate(rotationMat, cameraVelocity, glm::vec3(0.0, 1.0, 0.0));
+                scene.cameraDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
+            }
+            if (AppKeyPressed(app, GLFW_KEY_RIGHT)) {
+                glm::mat4 rotationMat(1);
+                rotationMat = glm::rotate(rotationMat, -cameraVelocity, glm::vec3(0.0, 1.0, 0.0));
+                scene.cameraDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
+            }
+            if (AppKeyPressed(app, GLFW_KEY_UP)) {
+                glm::mat4 rotationMat(1);
+                rotationMat = glm::rotate(rotationMat, cameraRotationUpVelocity, glm::cross(scene.cameraDir, glm::vec3(0.0, 1.0, 0.0)));
+                glm::vec3 newDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
+                if (glm::abs(glm::sin(glm::acos(glm::dot(glm::normalize(newDir), glm::vec3(0.0, 1.0, 0.0))))) > 0.1) {
+                    scene.cameraDir = newDir;
+                }
+            }
+            if (AppKeyPressed(app, GLFW_KEY_DOWN)) {
+                glm::mat4 rotationMat(1);
+                rotationMat = glm::rotate(rotationMat, -cameraRotationUpVelocity, glm::cross(scene.cameraDir, glm::vec3(0.0, 1.0, 0.0)));
+                glm::vec3 newDir = glm::vec3(rotationMat * glm::vec4(scene.cameraDir, 1.0));
+                if (glm::abs(glm::sin(glm::acos(glm::dot(glm::normalize(newDir), glm::vec3(0.0, 1.0, 0.0))))) > 0.1) {
+                    scene.cameraDir = newDir;
+                }
+            }
+
+            float stepGroundHeight = TerrainHeightAt(terrainPyramid, scene.cameraPos.x, scene.cameraPos.z);
+            scene.cameraPos.y = std::max(scene.cameraPos.y, stepGroundHeight + cameraGroundClearance);
+            if (recordingPath) {
+                cameraPath.samples.push_back({scene.cameraPos, scene.cameraDir});
             }
         }
+        float groundHeight = TerrainHeightAt(terrainPyramid, scene.cameraPos.x, scene.cameraPos.z);
 
         std::vector<glm::mat4> lightProjections;
-        std::vector<glm::mat4> lightSpaceMatrices;
         for (int i = 0; i < 3; i++) {
-            lightSpaceMatrices.push_back(glm::mat4(0.0));
             lightProjections.push_back(glm::mat4(0.0));
         }
 
-        scene.shadowDepthTextures = shadowDepthTextures;
-        scene.lightSpaceMatrices = lightSpaceMatrices;
-
+        scene.shadowAtlas = shadowMap.depthTexture;
+        scene.shadowMomentsAtlas = shadowMap.momentsTexture;
         // Get windows size
         int display_w, display_h;
-        glfwGetFramebufferSize(window, &display_w, &display_h);
+        AppFrameBufferSize(app, display_w, display_h);
+        // The main pass size follows the GPU time of the frames before
+        UpdateDynamicResolution(dynamicResolution, ProfilerFrameGpuMs(profiler));
+        int render_w, render_h;
+        DynamicResolutionSize(dynamicResolution, display_w, display_h, render_w, render_h);
+        if (display_w > 0 && display_h > 0 && (render_w != sceneWidth || render_h != sceneHeight)) {
+            InitSceneFrameBuffer(render_w, render_h);
+            DeleteDepthReduction(depthReduction);
+            CreateDepthReduction(depthReduction, render_w, render_h);
+        }
+        int reflectionW = std::max(1, (int) (render_w * reflectionScale));
+        int reflectionH = std::max(1, (int) (render_h * reflectionScale));
+        if (display_w > 0 && display_h > 0 && (reflectionW != reflectionWidth || reflectionH != reflectionHeight)) {
+            InitReflectionFrameBuffer(reflectionW, reflectionH);
+            lastReflectionFrame = -1;
+        }
+        frameIndex++;
 
+        // Animation is a function of the step count, so playback reproduces it exactly
         glm::mat4 rotationBoat(1);
-        rotationBoat = glm::rotate(rotationBoat, glm::radians(boatVelocity),
+        rotationBoat = glm::rotate(rotationBoat,
+                                   (float) std::fmod(glm::radians((double) boatVelocity) * animationClock.step, 2.0 * glm::pi<double>()),
                                    glm::vec3(0.0, 1.0, 0.0));
-        boatRadius = glm::vec3(rotationBoat * glm::vec4(boatRadius, 1.0));
+        boatRadius = glm::vec3(rotationBoat * glm::vec4(boatStartRadius, 1.0));
         scene.boatRotation = glm::atan(glm::dot(boatRadius, boatOrtoRadius), glm::dot(boatRadius, boatStartRadius));
         scene.boat.position = boatCentre + boatRadius;
 
@@ -323,145 +644,436 @@ int main(int, char **) {
                 glm::vec3(0, 1, 0)
         );
 
-        glm::mat4 rotationProjector(1);
-        rotationProjector = glm::rotate(rotationProjector, projectorVelocity, glm::vec3(0.0, 1.0, 0.0));
-        scene.projector.direction = glm::vec3(rotationProjector * glm::vec4(scene.projector.direction, 1.0));
-
-        windFactor += windVelocity;
-        if (windFactor > 1.0) {
-            windFactor = 0;
+        bool mousePressed = AppMouseButtonPressed(app, GLFW_MOUSE_BUTTON_LEFT);
+        if (mousePressed && !wasMousePressed && !io.WantCaptureMouse) {
+            double cursorX, cursorY;
+            int windowW, windowH;
+            AppCursor(app, cursorX, cursorY, windowW, windowH);
+            float ndcX = 2.0f * (float) cursorX / windowW - 1.0f;
+            float ndcY = 1.0f - 2.0f * (float) cursorY / windowH;
+            glm::mat4 inverseViewProjection = glm::inverse(scene.Projection * scene.View);
+            glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+            glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+            glm::vec3 rayStart = glm::vec3(nearPoint) / nearPoint.w;
+            glm::vec3 rayEnd = glm::vec3(farPoint) / farPoint.w;
+            RaycastTerrain(terrainPyramid, rayStart, rayEnd - rayStart, glm::length(rayEnd - rayStart), pickedPoint);
         }
+        wasMousePressed = mousePressed;
 
-        glEnable(GL_CLIP_DISTANCE0);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, reflectionFrameBuffer);
-        glViewport(0, 0, REFLECTION_WIDTH, REFRACTION_HEIGHT);
-
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        float cameraToWaterDistance = scene.cameraPos.y - waterLevel;
-        scene.cameraPos.y -= 2 * cameraToWaterDistance;
-        scene.cameraDir.y *= -1;
-        scene.View = glm::lookAt(
-                scene.cameraPos,
-                scene.cameraDir + scene.cameraPos,
-                glm::vec3(0, 1, 0)
-        );
-
-        glm::mat4 oldProjection = scene.Projection;
-        glm::vec4 waterPlane = glm::vec4(0, 1, 0, -waterLevel);
-        Projection = CalculateOblique(oldProjection, scene.View * waterPlane);
-        scene.waterNormal = 1.0f;
-        scene.DrawScene();
-        scene.cameraPos.y += 2 * cameraToWaterDistance;
-        scene.cameraDir.y *= -1;
-        scene.View = glm::lookAt(
-                scene.cameraPos,
-                scene.cameraDir + scene.cameraPos,
-                glm::vec3(0, 1, 0)
-        );
-        scene.Projection = oldProjection;
-
-        glBindFramebuffer(GL_FRAMEBUFFER, refractionFrameBuffer);
-
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        scene.waterNormal = -1.0f;
-        scene.DrawScene();
+        glm::mat4 rotationProjector(1);
+        rotationProjector = glm::rotate(rotationProjector, (float) std::fmod(projectorVelocity * animationClock.step, 2.0 * glm::pi<double>()),
+                                        glm::vec3(0.0, 1.0, 0.0));
+        scene.projector.direction = glm::vec3(rotationProjector * glm::vec4(projectorStartDirection, 1.0));
+
+        bool boatLit = TerrainLineOfSight(terrainPyramid, scene.projector.position, scene.boat.position);
+
+        ImGui::Begin("Terrain");
+        if (pickedPoint.hit) {
+            ImGui::Text("Picked (%.2f, %.2f, %.2f), distance %.2f, cell (%d, %d)",
+                        pickedPoint.position.x, pickedPoint.position.y, pickedPoint.position.z,
+                        pickedPoint.distance, pickedPoint.cell.x, pickedPoint.cell.y);
+        } else {
+            ImGui::Text("Click the terrain to pick a point");
+        }
+        ImGui::Text("Ground under camera: %.2f", groundHeight);
+        ImGui::Text("Boat in line of sight of the projector: %s", boatLit ? "yes" : "no");
+        ImGui::Separator();
+        bool sunChanged = ImGui::SliderFloat("Sun azimuth", &sunAzimuth, -180.0f, 180.0f);
+        sunChanged |= ImGui::SliderFloat("Sun elevation", &sunElevation, 1.0f, 89.0f);
+        if (sunChanged) {
+            float azimuth = glm::radians(sunAzimuth);
+            float elevation = glm::radians(sunElevation);
+            scene.sun.direction = sunDistance * glm::vec4(glm::cos(elevation) * glm::cos(azimuth),
+                                                          glm::sin(elevation),
+                                                          glm::cos(elevation) * glm::sin(azimuth),
+                                                          0.0f);
+        }
+        if (ImGui::Checkbox("Terrain shadows from horizon map", &scene.useHorizonMap)) {
+            InvalidateShadowCache(shadowMap);
+        }
+        if (horizonBaker.Busy()) {
+            ImGui::SameLine();
+            ImGui::Text("(rebaking)");
+        }
+        ImGui::Separator();
+        ImGui::Checkbox("Albedo clipmap in reflection pass", &clipmapInReflection);
+        ImGui::SliderFloat("Reflection scale", &reflectionScale, 0.25f, 1.0f);
+        ImGui::SliderInt("Reflection interval", &reflectionInterval, 1, 8);
+        ImGui::Checkbox("Reduced reflection draw list", &reflectionReducedDraw);
+        ImGui::Text("Reflection %d x %d", reflectionWidth, reflectionHeight);
+        ImGui::Checkbox("Water refraction from main pass", &waterInputs.refraction);
+        ImGui::Checkbox("Albedo clipmap in main pass", &clipmapInMainPass);
+        ImGui::Text("Clipmap tiles baked last frame: %d", albedoClipmap.tilesBakedLastUpdate);
+        ImGui::Separator();
+        ImGui::Checkbox("Dynamic resolution", &dynamicResolution.enabled);
+        if (dynamicResolution.enabled) {
+            ImGui::SliderFloat("GPU budget, ms", &dynamicResolution.targetMs, 4.0f, 50.0f);
+            ImGui::SliderFloat("Minimum scale", &dynamicResolution.minScale, 0.25f, 1.0f);
+            ImGui::SliderFloat("Maximum scale", &dynamicResolution.maxScale, dynamicResolution.minScale, 1.0f);
+            if (!profiler.enabled) {
+                ImGui::TextDisabled("Needs the profiler for GPU times");
+            }
+        } else {
+            ImGui::SliderFloat("Resolution scale", &dynamicResolution.scale, 0.25f, 1.0f);
+        }
+        ImGui::Text("Main pass %d x %d (%.0f%%), GPU %.2f ms", sceneWidth, sceneHeight,
+                    100.0f * dynamicResolution.scale, ProfilerFrameGpuMs(profiler));
+        ImGui::End();
+
+        ImGui::Begin("Shadows");
+        ImGui::SliderFloat("Split lambda (uniform - log)", &cascadeSplitLambda, 0.0f, 1.0f);
+        ImGui::SliderFloat("Cascade blend band", &scene.shadowCascadeBlend, 0.0f, 0.5f);
+        ImGui::Checkbox("Exponential variance shadows", &shadowMap.useMoments);
+        if (shadowMap.useMoments) {
+            // A new kernel only reaches regions as they are re-rendered, so refresh them all
+            if (ImGui::SliderInt("Blur radius", &shadowMap.blurRadius, 0, 8)) {
+                shadowMap.momentsCurrent = false;
+            }
+        }
+        ImGui::Checkbox("Fit splits to visible depth", &fitSplitsToDepth);
+        if (fitSplitsToDepth && depthReduction.valid) {
+            ImGui::SameLine();
+            ImGui::Text("(%.2f - %.2f)", depthReduction.result.x, depthReduction.result.y);
+        }
+        if (planes.size() == 4) {
+            ImGui::Text("Splits: %.1f / %.1f / %.1f / %.1f", planes[0], planes[1], planes[2], planes[3]);
+        }
+        ImGui::Checkbox("Cache static casters", &shadowMap.useStaticCache);
+        ImGui::Text("Views re-rendered last frame: %d / %d", shadowMap.viewsRenderedLastFrame, (int) shadowMap.views.size());
+        int usedTexels = 0;
+        for (const ShadowView& view : shadowMap.views) {
+            usedTexels += view.region.size * view.region.size;
+        }
+        ImGui::Text("Atlas %d x %d, %.0f%% used, %.1f MB",
+                    shadowMap.atlasSize, shadowMap.atlasSize,
+                    100.0f * usedTexels / ((float) shadowMap.atlasSize * shadowMap.atlasSize),
+                    ShadowMapMemory(shadowMap) / (1024.0f * 1024.0f));
+        ImGui::Text("Projector static cube: 6 x %d^2, %.1f MB", projectorShadowCube.size,
+                    6.0f * projectorShadowCube.size * projectorShadowCube.size * 4 / (1024.0f * 1024.0f));
+        ImGui::Separator();
+        ImGui::Checkbox("Stagger cascade updates", &cascadeSchedule.enabled);
+        for (int i = 0; i < shadowMap.cascades; i++) {
+            ImGui::SliderInt(("Cascade " + std::to_string(i) + " interval").c_str(), &cascadeSchedule.intervals[i], 1, 8);
+        }
+        ImGui::SliderInt("Cascades per frame", &cascadeSchedule.budget, 1, shadowMap.cascades);
+        ImGui::Text("Updated last frame: %s %s %s",
+                    cascadeSchedule.lastMask & 1 ? "near" : "-",
+                    cascadeSchedule.lastMask & 2 ? "middle" : "-",
+                    cascadeSchedule.lastMask & 4 ? "far" : "-");
+        ImGui::End();
+
+        ImGui::Begin("Render graph");
+        ImGui::Text("Compiled %d times", frameGraph.compilations);
+        ImGui::Text("Transient targets: %.1f MB declared, %.1f MB allocated",
+                    RenderGraphTransientMemory(frameGraph) / (1024.0f * 1024.0f),
+                    RenderGraphPoolMemory(frameGraph) / (1024.0f * 1024.0f));
+        ImGui::Separator();
+        for (const RenderGraphPass& pass : frameGraph.passes) {
+            if (pass.culled) {
+                ImGui::TextDisabled("%s (culled)", pass.name.c_str());
+            } else {
+                ImGui::Text("%s", pass.name.c_str());
+            }
+        }
+        ImGui::End();
+
+        DrawProfilerWindow(profiler);
+        DrawRenderStatsWindow(renderStats);
+        DrawOcclusionWindow(occlusion);
+#ifdef SCENE_TRACE
+        ImGui::Begin("Profiler");
+        if (ImGui::Button("Save CPU trace")) {
+            WriteTrace("scene_trace.json");
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("scene_trace.json, open in ui.perfetto.dev");
+        ImGui::End();
+#endif
+
+        if (scene.useHorizonMap) {
+            horizonBaker.Update(glm::vec3(scene.sun.direction));
+            if (horizonBaker.Poll(horizonMap)) {
+                UpdateHorizonTexture(scene.horizonTexture, horizonMap);
+            }
+        }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        windFactor = (float) std::fmod(windVelocity * animationClock.step, 1.0);
 
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDisable(GL_CLIP_DISTANCE0);
+        // Only baked while a pass samples it; scrolling back in range afterwards re-bakes what moved
+        if (clipmapInMainPass || clipmapInReflection) {
+            BeginProfilerZone(profiler, "albedo clipmap");
+            UpdateAlbedoClipmap(albedoClipmap, scene.landscape, landscapeBakeShader, scene.cameraPos);
+            EndProfilerZone(profiler);
+        } else {
+            albedoClipmap.tilesBakedLastUpdate = 0;
+        }
+        scene.albedoClipmapTexture = albedoClipmap.texture;
+        scene.albedoClipmapMin = AlbedoClipmapMin(albedoClipmap);
+        scene.albedoClipmapMax = AlbedoClipmapMax(albedoClipmap);
+        scene.albedoClipmapExtent = albedoClipmap.extent;
 
         float nearPlane = 1.0f, farPlane = 24.0f;
         glm::mat4 lightView = glm::lookAt(glm::vec3(0,-1,0) + 10.0f * glm::vec3(scene.sun.direction.x, scene.sun.direction.y, scene.sun.direction.z),
                                           glm::vec3(0.0f, 0.0f,  0.0f),
                                           glm::vec3(0.0f, 1.0f,  0.0f));
 
-        CalculateCascades(lightProjections, planes, scene.View, lightView, display_w, display_h, fov);
-
-        glm::mat4 oldView = scene.View;
-        oldProjection = scene.Projection;
-
-        for (int i = 0; i < 3; i++) {
-            glViewport(0, 0, resolutions[i].first, resolutions[i].second);
-            glBindFramebuffer(GL_FRAMEBUFFER, shadowFrameBuffers[i]);
-            glClear(GL_DEPTH_BUFFER_BIT);
-
-            scene.View = lightView;
-            scene.Projection = lightProjections[i];
-            lightSpaceMatrices[i] = scene.Projection * scene.View;
-
-            scene.DrawShadows();
-
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        // Shadows only need to reach the farthest corner of the scene; quantized so
+        // the splits, and with them the cascade sizes, stay put while the camera moves
+        float sceneFar = 0.0f;
+        for (int j = 0; j < 8; j++) {
+            glm::vec3 corner(j & 1 ? sceneMax.x : sceneMin.x, j & 2 ? sceneMax.y : sceneMin.y, j & 4 ? sceneMax.z : sceneMin.z);
+            sceneFar = std::max(sceneFar, glm::length(corner - scene.cameraPos));
+        }
+        sceneFar = std::min(200.0f, 4.0f * std::ceil(sceneFar / 4.0f));
+        float shadowFar = sceneFar;
+
+        // The reduced range is a few frames old; rounded outwards to half units so
+        // small depth changes don't move the cascades (and drop the static cache)
+        float shadowNear = 0.1f;
+        PollDepthReduction(depthReduction);
+        if (fitSplitsToDepth && depthReduction.valid) {
+            shadowNear = std::max(shadowNear, 0.5f * std::floor(depthReduction.result.x / 0.5f));
+            shadowFar = std::max(shadowNear + 0.5f, std::min(shadowFar, 0.5f * std::ceil(depthReduction.result.y / 0.5f)));
         }
 
-        glViewport(0, 0, display_w, display_h);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        scene.View = oldView;
-        scene.Projection = oldProjection;
-
-        scene.shadowDepthTextures = shadowDepthTextures;
-        scene.lightSpaceMatrices = lightSpaceMatrices;
-
-        scene.DrawScene();
-
-        waterShader.use();
-        waterShader.set_uniform("model", glm::value_ptr(scene.worldModel));
-        waterShader.set_uniform("view", glm::value_ptr(scene.View));
-        waterShader.set_uniform("projection", glm::value_ptr(scene.Projection));
-
-        waterShader.set_uniform("sunPosition", sun.direction.x, sun.direction.y, -sun.direction.z);
-        waterShader.set_uniform("projectorPosition", scene.projector.position.x, scene.projector.position.y, scene.projector.position.z);
-        waterShader.set_uniform("projectorDirection", scene.projector.direction.x, scene.projector.direction.y, scene.projector.direction.z);
-        waterShader.set_uniform("projectorAngle", projector.angle);
-        waterShader.set_uniform("cameraPosition", scene.cameraPos.x, scene.cameraPos.y, scene.cameraPos.z);
-        waterShader.set_uniform("windFactor", windFactor);
-
-        glActiveTexture(GL_TEXTURE0);
-        waterShader.set_uniform("reflection_texture", 0);
-        glBindTexture(GL_TEXTURE_2D, reflectionTexture);
-        glActiveTexture(GL_TEXTURE0 + 1);
-        waterShader.set_uniform("refraction_texture", 1);
-        glBindTexture(GL_TEXTURE_2D, scene.landscape.mesh.textures[0].id);
-        glActiveTexture(GL_TEXTURE0 + 2);
-        waterShader.set_uniform("water_normal", 2);
-        glBindTexture(GL_TEXTURE_2D, water.textures[1].id);
-
-        glActiveTexture(GL_TEXTURE0 + 3);
-        waterShader.set_uniform("water_dudv", 3);
-        glBindTexture(GL_TEXTURE_2D, water.textures[2].id);
-
+        CalculateCascadeSplits(planes, shadowMap.cascades, shadowNear, shadowFar, cascadeSplitLambda);
+        scene.planes = planes;
+        CalculateCascades(lightProjections, planes, scene.View, lightView, display_w, display_h, fov,
+                          cascadeResolutions, sceneMin, sceneMax);
+
+        int cascadeMask = ScheduleCascades(cascadeSchedule, shadowMap.cascades);
+
+        // The frame as passes over declared targets; passes nobody reads from are
+        // culled, e.g. the refraction copy while the water doesn't sample it
+        BeginRenderGraph(frameGraph);
+        int shadowTarget = ImportRenderTarget(frameGraph, "shadow atlas", shadowMap.frameBuffer, 0, shadowMap.depthTexture);
+        int reflectionTarget = ImportRenderTarget(frameGraph, "reflection", reflectionFrameBuffer, reflectionTexture);
+        int sceneTarget = ImportRenderTarget(frameGraph, "scene", sceneFrameBuffer, sceneTexture, sceneDepthTexture);
+        // Same formats as the scene framebuffer so both color and depth can be blitted across
+        RenderTargetDesc refractionDesc;
+        refractionDesc.width = render_w;
+        refractionDesc.height = render_h;
+        refractionDesc.colorFormat = GL_RGB;
+        refractionDesc.depthFormat = GL_DEPTH_COMPONENT;
+        int refractionTarget = CreateRenderTarget(frameGraph, "refraction", refractionDesc);
+
+        AddRenderPass(frameGraph, "shadows", {}, {shadowTarget}, [&]() {
+            // Shares the cube's depth range, whose near plane keeps the projector's own
+            // housing out of its shadow
+            UpdateStaticShadowCube(projectorShadowCube, scene, scene.projector.position);
+            std::vector<glm::mat4> spotMatrices {
+                    glm::perspective(2.0f * projector.angle, 1.0f,
+                                     projectorShadowCube.nearPlane, projectorShadowCube.farPlane)
+                    * glm::lookAt(scene.projector.position,
+                                  scene.projector.position + scene.projector.direction,
+                                  glm::vec3(0.0f, 1.0f, 0.0f))
+            };
 
-        glBindVertexArray(water.MeshVAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            RenderShadowMap(shadowMap, scene, lightView, lightProjections, spotMatrices,
+                            cascadeMask | (1 << scene.projectorShadowView));
+            UpdateShadowMoments(shadowMap, shadowMomentsShader, cascadeMask);
+            scene.useShadowMoments = shadowMap.useMoments;
+            scene.shadowExponent = shadowMap.exponent;
+        });
+
+        AddRenderPass(frameGraph, "reflection", {shadowTarget}, {reflectionTarget}, [&]() {
+            bool reflectionDue = lastReflectionFrame < 0 || frameIndex - lastReflectionFrame >= reflectionInterval;
+            if (!reflectionDue) {
+                return;
+            }
+            lastReflectionFrame = frameIndex;
+            glBindFramebuffer(GL_FRAMEBUFFER, reflectionFrameBuffer);
+            CountFrameBufferBind();
+            glViewport(0, 0, reflectionWidth, reflectionHeight);
+            glEnable(GL_CLIP_DISTANCE0);
+
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            // Mirror the camera in the water plane and put everything back afterwards
+            glm::vec3 cameraPos = scene.cameraPos;
+            glm::vec3 cameraDir = scene.cameraDir;
+            glm::mat4 view = scene.View;
+            glm::mat4 projection = scene.Projection;
+
+            scene.cameraPos.y = 2 * waterLevel - scene.cameraPos.y;
+            scene.cameraDir.y *= -1;
+            scene.View = glm::lookAt(
+                    scene.cameraPos,
+                    scene.cameraDir + scene.cameraPos,
+                    glm::vec3(0, 1, 0)
+            );
+            reflectionViewProjection = scene.Projection * scene.View;
+
+            // GL_CLIP_DISTANCE0 cuts everything below the water plane
+            scene.waterNormal = 1.0f;
+            scene.useAlbedoClipmap = clipmapInReflection;
+            scene.occlusionPass = "reflection";
+            scene.drawProjectorCube = !reflectionReducedDraw;
+            scene.useReducedLandscape = reflectionReducedDraw;
+            scene.receiveShadows = !reflectionReducedDraw;
+            scene.DrawScene();
+            scene.drawProjectorCube = true;
+            scene.useReducedLandscape = false;
+            scene.receiveShadows = true;
+            scene.useAlbedoClipmap = clipmapInMainPass;
+            scene.occlusionPass = "main";
+
+            scene.cameraPos = cameraPos;
+            scene.cameraDir = cameraDir;
+            scene.View = view;
+            scene.Projection = projection;
+            glDisable(GL_CLIP_DISTANCE0);
+        });
+
+        AddRenderPass(frameGraph, "main", {shadowTarget}, {sceneTarget}, [&]() {
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFrameBuffer);
+            CountFrameBufferBind();
+            glViewport(0, 0, render_w, render_h);
+            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            scene.DrawScene();
+        });
+
+        // The refraction is a copy of the main pass taken just before the water is drawn
+        AddRenderPass(frameGraph, "refraction copy", {sceneTarget}, {refractionTarget}, [&]() {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFrameBuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, RenderGraphFrameBuffer(frameGraph, refractionTarget));
+            CountFrameBufferBind();
+            glBlitFramebuffer(0, 0, render_w, render_h, 0, 0, render_w, render_h,
+                              GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        });
+
+        std::vector<int> waterReads {sceneTarget};
+        if (waterInputs.reflection) {
+            waterReads.push_back(reflectionTarget);
+        }
+        if (waterInputs.refraction) {
+            waterReads.push_back(refractionTarget);
+        }
+        AddRenderPass(frameGraph, "water", waterReads, {sceneTarget}, [&]() {
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFrameBuffer);
+            CountFrameBufferBind();
+            glViewport(0, 0, render_w, render_h);
+
+            waterShader.use();
+            waterShader.set_uniform("model", glm::value_ptr(scene.worldModel));
+            waterShader.set_uniform("view", glm::value_ptr(scene.View));
+            waterShader.set_uniform("projection", glm::value_ptr(scene.Projection));
+
+            waterShader.set_uniform("sunPosition", scene.sun.direction.x, scene.sun.direction.y, -scene.sun.direction.z);
+            waterShader.set_uniform("projectorPosition", scene.projector.position.x, scene.projector.position.y, scene.projector.position.z);
+            waterShader.set_uniform("projectorDirection", scene.projector.direction.x, scene.projector.direction.y, scene.projector.direction.z);
+            waterShader.set_uniform("projectorAngle", projector.angle);
+            waterShader.set_uniform("cameraPosition", scene.cameraPos.x, scene.cameraPos.y, scene.cameraPos.z);
+            waterShader.set_uniform("windFactor", windFactor);
+            waterShader.set_uniform("reflectionViewProjection", glm::value_ptr(reflectionViewProjection));
+
+            glActiveTexture(GL_TEXTURE0);
+            waterShader.set_uniform("reflection_texture", 0);
+            glBindTexture(GL_TEXTURE_2D, reflectionTexture);
+            glActiveTexture(GL_TEXTURE0 + 1);
+            waterShader.set_uniform("refraction_texture", 1);
+            glBindTexture(GL_TEXTURE_2D, RenderGraphColorTexture(frameGraph, refractionTarget));
+            glActiveTexture(GL_TEXTURE0 + 4);
+            waterShader.set_uniform("refraction_depth", 4);
+            glBindTexture(GL_TEXTURE_2D, RenderGraphDepthTexture(frameGraph, refractionTarget));
+            waterShader.set_uniform("useRefraction", waterInputs.refraction);
+            waterShader.set_uniform("depthRange", 0.1f, 200.0f);
+            glActiveTexture(GL_TEXTURE0 + 2);
+            waterShader.set_uniform("water_normal", 2);
+            glBindTexture(GL_TEXTURE_2D, water.textures[1].id);
+
+            glActiveTexture(GL_TEXTURE0 + 3);
+            waterShader.set_uniform("water_dudv", 3);
+            glBindTexture(GL_TEXTURE_2D, water.textures[2].id);
+            CountTextureBinds(5);
+
+            CountDraw(2);
+            glBindVertexArray(water.MeshVAO);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        });
+
+        // Reads the depth back for next frame's splits, so it only counts as needed while fitting
+        AddRenderPass(frameGraph, "depth reduction", {sceneTarget}, {}, [&]() {
+            ReduceDepth(depthReduction, depthReduceInitShader, depthReduceShader, sceneDepthTexture,
+                        0.1f, 200.0f, sceneFar);
+        }, fitSplitsToDepth);
+
+        // Upscales a scaled down main pass bilinearly
+        AddRenderPass(frameGraph, "present", {sceneTarget}, {}, [&]() {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFrameBuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, AppFrameBuffer(app));
+            CountFrameBufferBind();
+            glBlitFramebuffer(0, 0, render_w, render_h, 0, 0, display_w, display_h, GL_COLOR_BUFFER_BIT,
+                              render_w == display_w && render_h == display_h ? GL_NEAREST : GL_LINEAR);
+            glBindFramebuffer(GL_FRAMEBUFFER, AppFrameBuffer(app));
+            CountFrameBufferBind();
+            glViewport(0, 0, display_w, display_h);
+        }, true);
+
+        CompileRenderGraph(frameGraph);
+        {
+            TRACE_ZONE("ExecuteRenderGraph");
+            ExecuteRenderGraph(frameGraph, profiler, renderStats);
+        }
 
         // Generate gui render commands
         ImGui::Render();
 
         // Execute gui render commands using OpenGL backend
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        if (!app.headless) {
+            BeginProfilerZone(profiler, "gui");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            EndProfilerZone(profiler);
+        }
 
         // Swap the backbuffer with the frontbuffer that is used for screen display
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            TRACE_ZONE("PresentApp");
+            PresentApp(app);
+        }
+        auto frameEnd = std::chrono::steady_clock::now();
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+        frameStart = frameEnd;
+
+        int frameNumber = (int) frameTimes.size();
+        if (!dumpDirectory.empty() && frameNumber - 1 >= dumpOffset && (frameNumber - 1 - dumpOffset) % dumpInterval == 0) {
+            SaveAppFrame(app, fmt::format("{}/frame_{:05d}.ppm", dumpDirectory, frameNumber - 1));
+        }
+    }
+
+    if (app.headless || playingPath) {
+        PrintFrameTimeSummary(std::cout, SummarizeFrameTimes(frameTimes));
+        std::cout << fmt::format("Occlusion queries: {} of {} tested meshes occluded\n", occludedMeshes, testedMeshes);
+    }
+    if (recordingPath) {
+        SaveCameraPath(cameraPath, recordPathFile);
+    }
+
+    if (!tracePath.empty()) {
+        WriteTrace(tracePath);
     }
 
     // Cleanup
     CleanUp();
+    DeleteAlbedoClipmap(albedoClipmap);
+    DeleteShadowMap(shadowMap);
+    DeleteStaticShadowCube(projectorShadowCube);
+    DeleteRenderGraph(frameGraph);
+    DeleteGpuProfiler(profiler);
+    StopRenderStatsCsv(renderStats);
+    DeleteDepthReduction(depthReduction);
+    DeleteOcclusionCulling(occlusion);
 
     ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    if (!app.headless) {
+        ImGui_ImplGlfw_Shutdown();
+    }
     ImGui::DestroyContext();
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    DestroyAppContext(app);
 
     return 0;
 }
@@ -11,6 +11,8 @@
 
 #include <GL/glew.h>
 
+#include "render_stats.h"
+
 #include "imgui.h"
 #include "bindings/imgui_impl_glfw.h"
 #include "bindings/imgui_impl_opengl3.h"
@@ -20,6 +22,7 @@
 
 #include<iostream>
 #include<string>
+#include<limits>
 
 bool FileExists(const std::string& abs_filename) {
     bool ret;
@@ -43,6 +46,7 @@ void LoadTexture(Model& model,
                  const std::string& texture_type,
                  std::vector<Texture>& textures,
                  const std::string& basepath) {
+    TRACE_ZONE("LoadTexture");
     if (texture_filename.length() == 0)
         return;
 
@@ -188,6 +192,7 @@ Mesh LoadMesh(Model& model,
 }
 
 void LoadModel(Model& model, const std::string& filename, const std::string& basepath, float factor) {
+    TRACE_ZONE("LoadModel");
     tinyobj::attrib_t attrib;
     std::vector <tinyobj::shape_t> shapes;
     std::vector <tinyobj::material_t> materials;
@@ -207,6 +212,7 @@ void LoadModel(Model& model, const std::string& filename, const std::string& bas
 }
 
 unsigned int LoadCubemapTexture(std::vector<std::string> faces) {
+    TRACE_ZONE("LoadCubemapTexture");
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
@@ -330,6 +336,8 @@ void DrawMesh(Mesh& mesh, shader_t& shader) {
     shader.set_uniform("in_specular", mesh.specular.x, mesh.specular.y, mesh.specular.z);
     shader.set_uniform("in_diffuse", mesh.diffuse.x, mesh.diffuse.y, mesh.diffuse.z);
 
+    CountTextureBinds(mesh.textures.size());
+    CountDraw(mesh.IndexCount / 3);
     glBindVertexArray(mesh.MeshVAO);
     glDrawElements(GL_TRIANGLES, mesh.IndexCount, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
@@ -339,11 +347,14 @@ void DrawCubemap(unsigned int vao, unsigned int texture, shader_t& shader) {
     glBindVertexArray(vao);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    CountTextureBinds(1);
+    CountDraw(12);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
 }
 
 Texture LoadTileTexture(const std::string& path) {
+    TRACE_ZONE("LoadTileTexture");
     Texture texture;
 
     unsigned int textureID;
@@ -383,6 +394,8 @@ void DrawWater(Mesh& water, shader_t& shader, unsigned int reflection_texture) {
     shader.set_uniform("reflection_texture", 0);
     glBindTexture(GL_TEXTURE_2D, reflection_texture);
 
+    CountTextureBinds(1);
+    CountDraw(2);
     glBindVertexArray(water.MeshVAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
@@ -438,7 +451,7 @@ void LoadWater(Mesh& water, const std::string& texture_path,
     water.textures.push_back(LoadTileTexture(dudv_path));
 }
 
-void DrawLandscape(Landscape& model, shader_t& shader) {
+void DrawLandscape(Landscape& model, shader_t& shader, bool reduced) {
     glActiveTexture(GL_TEXTURE0);
     shader.set_uniform("sand_texture", 0);
     glBindTexture(GL_TEXTURE_2D, model.mesh.textures[0].id);
@@ -454,8 +467,11 @@ void DrawLandscape(Landscape& model, shader_t& shader) {
     shader.set_uniform("sand_threshold", model.sandThreshold);
     shader.set_uniform("grass_threshold", model.grassThreshold);
 
-    glBindVertexArray(model.mesh.MeshVAO);
-    glDrawElements(GL_TRIANGLES, model.mesh.IndexCount, GL_UNSIGNED_INT, 0);
+    Mesh& mesh = reduced ? model.reducedMesh : model.mesh;
+    CountTextureBinds(3);
+    CountDraw(mesh.IndexCount / 3);
+    glBindVertexArray(mesh.MeshVAO);
+    glDrawElements(GL_TRIANGLES, mesh.IndexCount, GL_UNSIGNED_INT, 0);
 
     glBindVertexArray(0);
     glActiveTexture(GL_TEXTURE0);
@@ -471,32 +487,104 @@ void LoadLandscape(Landscape& landscape,
                    float sandThreshold,
                    float grassThreshold,
                    int scale) {
+    TRACE_ZONE("LoadLandscape");
     int width, height, nrChannels;
     unsigned char *data = stbi_load(height_path.c_str(), &width, &height, &nrChannels, 0);
-    if (data) {
-        if (nrChannels == 3) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        } else if (nrChannels == 4) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        }
-    } else {
+    if (!data) {
         std::cout << "Landscape tex failed to load at path: " << height_path << std::endl;
         stbi_image_free(data);
         exit(1);
     }
 
-    int currentPixel = 0;
+    std::vector<float> heights;
+    heights.reserve(width * height);
+    for (int currentPixel = 0; currentPixel < width * height * nrChannels; currentPixel += nrChannels) {
+        heights.push_back(data[currentPixel] / 255.0f);
+    }
+
+    stbi_image_free(data);
+
+    CreateLandscape(landscape, heights, width, height, sand_path, grass_path, rock_path,
+                    heightCoefficient, texture_density, sandThreshold, grassThreshold, scale);
+}
+
+namespace {
+    // Same placement and texture tiling as the full landscape mesh, but a plain
+    // grid with shared vertices over every step-th texel. Texture coordinates
+    // run on past 1 and rely on GL_REPEAT instead of wrapping per vertex.
+    void CreateReducedLandscapeMesh(Mesh& mesh, const std::vector<std::vector<float>>& heightMap,
+                                    int width, int height, int texture_density, int scale, int step) {
+        int rows = (height - 1) / step + 1;
+        int columns = (width - 1) / step + 1;
+
+        std::vector<float> vertices;
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < columns; c++) {
+                int hh = r * step;
+                int ww = c * step;
+                vertices.push_back(((float) hh / height - 1) * scale);
+                vertices.push_back(heightMap[hh][ww]);
+                vertices.push_back(((float) ww / width - 1) * scale);
+                vertices.push_back((float) hh / texture_density);
+                vertices.push_back((float) ww / texture_density);
+            }
+        }
+
+        std::vector<unsigned int> indices;
+        for (int r = 0; r + 1 < rows; r++) {
+            for (int c = 0; c + 1 < columns; c++) {
+                unsigned int i0 = r * columns + c;
+                unsigned int i1 = i0 + columns;
+                indices.insert(indices.end(), {i0, i0 + 1, i1, i1, i0 + 1, i1 + 1});
+            }
+        }
+
+        unsigned int VBO, VAO, EBO;
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(sizeof(float) * 3));
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+
+        mesh.IndexCount = indices.size();
+        mesh.MeshVAO = VAO;
+    }
+}
+
+void CreateLandscape(Landscape& landscape,
+                     const std::vector<float>& heights,
+                     int width,
+                     int height,
+                     const std::string sand_path,
+                     const std::string grass_path,
+                     const std::string rock_path,
+                     float heightCoefficient,
+                     int texture_density,
+                     float sandThreshold,
+                     float grassThreshold,
+                     int scale) {
+    TRACE_ZONE("CreateLandscape");
+    landscape.heightMap.clear();
     for (int i = 0; i < height; i++) {
-        std::vector<float> row;
+        std::vector<float> row(width);
         for (int j = 0; j < width; j++) {
-            row.push_back(data[currentPixel] / 255.0f * heightCoefficient);
-            currentPixel += nrChannels;
+            row[j] = heights[i * width + j] * heightCoefficient;
         }
         landscape.heightMap.push_back(row);
     }
 
-    stbi_image_free(data);
-
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
     unsigned int indicesOffset = 0;
@@ -599,10 +687,13 @@ void LoadLandscape(Landscape& landscape,
 
     landscape.mesh.IndexCount = indices.size();
     landscape.mesh.MeshVAO = VAO;
+    CreateReducedLandscapeMesh(landscape.reducedMesh, landscape.heightMap, width, height,
+                               texture_density, scale, kReducedLandscapeStep);
     landscape.mesh.textures.push_back(LoadTileTexture(sand_path));
     landscape.mesh.textures.push_back(LoadTileTexture(grass_path));
     landscape.mesh.textures.push_back(LoadTileTexture(rock_path));
 
+    landscape.heightCoefficient = heightCoefficient;
     landscape.grassThreshold = grassThreshold;
     landscape.sandThreshold = sandThreshold;
 
@@ -611,6 +702,18 @@ void LoadLandscape(Landscape& landscape,
     landscape.mapHeight = height;
 }
 
+void ModelBounds(Model& model, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+    boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+    for (Mesh& mesh : model.meshes) {
+        for (size_t i = 0; i + 2 < mesh.vertices.size(); i += 8) {
+            glm::vec3 position(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+    }
+}
+
 float GetHeight(Landscape& landscape, int x, int z) {
     return landscape.heightMap[landscape.mapHeight - x * landscape.mapHeight / landscape.scale]
         [landscape.mapWidth - z * landscape.mapHeight / landscape.scale];
@@ -697,8 +800,20 @@ unsigned int CreateShadowBuffer(unsigned int shadowWidth, unsigned int shadowHei
     return FBO;
 }
 
+void CalculateCascadeSplits(std::vector<float>& cascadePlanes, int cascades, float nearPlane, float farPlane, float lambda) {
+    cascadePlanes.resize(cascades + 1);
+    for (int i = 0; i <= cascades; i++) {
+        float f = (float) i / cascades;
+        float logSplit = nearPlane * std::pow(farPlane / nearPlane, f);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * f;
+        cascadePlanes[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+    }
+}
+
 void CalculateCascades(std::vector<glm::mat4>& lightProjections, std::vector<float>& cascadePlanes, glm::mat4 cameraView,
-                       glm::mat4 lightView, int display_w, int display_h, float displayAngle) {
+                       glm::mat4 lightView, int display_w, int display_h, float displayAngle,
+                       const std::vector<int>& resolutions, glm::vec3 sceneMin, glm::vec3 sceneMax) {
+    TRACE_ZONE("CalculateCascades");
     float fovV = displayAngle;
     float ar = (float) display_w / (float) display_h;
     float fovH  = glm::atan(glm::tan(fovV / 2) * ar) * 2;
@@ -707,6 +822,19 @@ void CalculateCascades(std::vector<glm::mat4>& lightProjections, std::vector<flo
 
     glm::mat4 cameraInverse = glm::inverse(cameraView);
 
+    // Depth range covers every caster in the scene, not just the frustum slice
+    float minZ = std::numeric_limits<float>::max();
+    float maxZ = -std::numeric_limits<float>::max();
+    for (int j = 0; j < 8; j++) {
+        glm::vec4 corner(j & 1 ? sceneMax.x : sceneMin.x,
+                         j & 2 ? sceneMax.y : sceneMin.y,
+                         j & 4 ? sceneMax.z : sceneMin.z,
+                         1.0f);
+        float z = (lightView * corner).z;
+        minZ = std::min(minZ, z);
+        maxZ = std::max(maxZ, z);
+    }
+
     for (int i = 0; i < cascadePlanes.size() - 1; i++) {
         float xNear = cascadePlanes[i] * tanH;
         float xFar = cascadePlanes[i + 1] * tanH;
@@ -725,32 +853,26 @@ void CalculateCascades(std::vector<glm::mat4>& lightProjections, std::vector<flo
                 glm::vec4(-xFar, -yFar, -cascadePlanes[i + 1], 1.0)
         };
 
-        glm::vec4 lightFrustum[8];
-
-        float minX = 1000;
-        float maxX = -1000;
-        float minY = 1000;
-        float maxY = -1000;
-        float minZ = 1000;
-        float maxZ = -1000;
-
+        // A bounding sphere keeps the cascade size fixed while the camera turns
+        glm::vec3 centre(0.0f);
         for (int j = 0; j < 8; j++) {
-            glm::vec4 worldCorner = cameraInverse * frustum[j];
-            lightFrustum[j] = lightView * worldCorner;
-            minX = std::min(minX, lightFrustum[j].x);
-            maxX = std::max(maxX, lightFrustum[j].x);
-            minY = std::min(minY, lightFrustum[j].y);
-            maxY = std::max(maxY, lightFrustum[j].y);
-            minZ = std::min(minZ, lightFrustum[j].z);
-            maxZ = std::max(maxZ, lightFrustum[j].z);
+            centre += glm::vec3(cameraInverse * frustum[j]) / 8.0f;
         }
+        float radius = 0.0f;
+        for (int j = 0; j < 8; j++) {
+            radius = std::max(radius, glm::length(glm::vec3(cameraInverse * frustum[j]) - centre));
+        }
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // Moving the box in whole texels keeps shadow edges from shimmering
+        float texel = 2.0f * radius / resolutions[i];
+        glm::vec4 lightCentre = lightView * glm::vec4(centre, 1.0f);
+        lightCentre.x = std::floor(lightCentre.x / texel) * texel;
+        lightCentre.y = std::floor(lightCentre.y / texel) * texel;
 
-        if (minZ > 0.0f)
-            minZ = 0.0f;
-        if (maxZ > 0.0f)
-            maxZ = 0.0f;
-        glm::mat4 lightProjection = glm::ortho(minX - 1, maxX + 1, minY - 1, maxY + 1, -maxZ - 1, -minZ + 1);
-        lightProjections[i] = lightProjection;
+        lightProjections[i] = glm::ortho(lightCentre.x - radius, lightCentre.x + radius,
+                                         lightCentre.y - radius, lightCentre.y + radius,
+                                         -maxZ - 1, -minZ + 1);
     }
 }
 
@@ -5,6 +5,9 @@
 #include <vector>
 #include <map>
 #include "opengl_shader.h"
+#include "trace.h"
+#include "render_stats.h"
+#include "occlusion.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -54,8 +57,11 @@ struct DirectionalLight {
     glm::vec4 direction;
 };
 
+const int kReducedLandscapeStep = 4;
+
 struct Landscape {
    Mesh mesh;
+   Mesh reducedMesh;    // regular grid over every kReducedLandscapeStep-th texel, for cheap passes
    std::vector<std::vector<float>> heightMap;
    float heightCoefficient;
    float sandThreshold;
@@ -66,7 +72,7 @@ struct Landscape {
 };
 
 void DrawModel(Model& model, shader_t& shader);
-void DrawLandscape(Landscape& model, shader_t& shader);
+void DrawLandscape(Landscape& model, shader_t& shader, bool reduced = false);
 void DrawMesh(Mesh& mesh, shader_t& shader);
 void DrawCubemap(unsigned int vao, unsigned int texture, shader_t& shader);
 void DrawWater(Mesh& water, shader_t& shader, unsigned int reflection_texture);
@@ -86,6 +92,7 @@ public:
     shader_t landscapeShader;
     shader_t landscapeShaderShadow;
     shader_t modelShaderShadow;
+    shader_t simpleShaderShadow;
 
     glm::vec3 cameraPos;
     glm::vec3 cameraDir;
@@ -101,22 +108,52 @@ public:
     float waterLevel;
     float waterNormal;
 
-    std::vector<unsigned int> shadowDepthTextures;
-    std::vector<glm::mat4> lightSpaceMatrices;
+    // The view matrices and atlas regions come from the ShadowViews uniform block
+    unsigned int shadowAtlas;
+    int shadowViewMask = 15;    // bit i set: shadow draws write shadow view i
+    float shadowCascadeBlend = 0.1f;    // part of each cascade's depth range faded into the next
+    int projectorShadowView = -1;       // atlas view of the projector's spotlight, -1 for none
+    // Static casters around the projector, see StaticShadowCube; the atlas view only holds the boat
+    unsigned int projectorShadowCube;
+    float projectorShadowNear;
+    float projectorShadowFar;
+    unsigned int shadowMomentsAtlas;
+    bool useShadowMoments = false;
+    float shadowExponent = 40.0f;
     std::vector<float> planes;
 
+    // Terrain self-shadowing comes from the horizon map instead of the cascades,
+    // which then only hold the models.
+    unsigned int horizonTexture;
+    bool useHorizonMap = false;
+
+    // Landscape albedo from the pre-baked clipmap (one fetch) where it has coverage
+    bool useAlbedoClipmap = false;
+    unsigned int albedoClipmapTexture;
+    glm::vec2 albedoClipmapMin;
+    glm::vec2 albedoClipmapMax;
+    float albedoClipmapExtent;
+
+    // Cheaper draw list for secondary passes such as the water reflection
+    bool drawProjectorCube = true;
+    bool useReducedLandscape = false;
+    bool receiveShadows = true;
+
+    // Occlusion tests of the lighthouse (behind the terrain) and the boat (behind
+    // both) in DrawScene, named after the pass; none while occlusion is null
+    OcclusionCulling* occlusion = nullptr;
+    std::string occlusionPass = "main";
+    glm::vec3 lighthouseBoundsMin, lighthouseBoundsMax;
+    glm::vec3 boatBoundsMin, boatBoundsMax;
+
     void DrawScene() {
+        TRACE_ZONE("Scene::DrawScene");
         landscapeShader.use();
         worldModel = glm::translate(worldModel, glm::vec3(0, -0.05, 0));
         landscapeShader.set_uniform("model", glm::value_ptr(worldModel));
         landscapeShader.set_uniform("view", glm::value_ptr(View));
         landscapeShader.set_uniform("projection", glm::value_ptr(Projection));
-        landscapeShader.set_uniform("lightSpaceMatrix1", glm::value_ptr(lightSpaceMatrices[0]));
-        landscapeShader.set_uniform("lightSpaceMatrix2", glm::value_ptr(lightSpaceMatrices[1]));
-        landscapeShader.set_uniform("lightSpaceMatrix3", glm::value_ptr(lightSpaceMatrices[2]));
-        landscapeShader.set_uniform("plane1", planes[1]);
-        landscapeShader.set_uniform("plane2", planes[2]);
-        landscapeShader.set_uniform("plane3", planes[3]);
+        SetShadowUniforms(landscapeShader);
         landscapeShader.set_uniform("sunPosition", sun.direction.x, sun.direction.y, sun.direction.z);
         landscapeShader.set_uniform("projectorPosition", projector.position.x, projector.position.y, projector.position.z);
         landscapeShader.set_uniform("projectorDirection", projector.direction.x, projector.direction.y, projector.direction.z);
@@ -125,24 +162,30 @@ public:
         landscapeShader.set_uniform("waterLevel", waterLevel);
         landscapeShader.set_uniform("waterNormal", waterNormal);
 
-        glActiveTexture(GL_TEXTURE0 + 3);
-        landscapeShader.set_uniform("shadowMap1", 3);
-        glBindTexture(GL_TEXTURE_2D, shadowDepthTextures[0]);
-        glActiveTexture(GL_TEXTURE0 + 4);
-        landscapeShader.set_uniform("shadowMap2", 4);
-        glBindTexture(GL_TEXTURE_2D, shadowDepthTextures[1]);
-        glActiveTexture(GL_TEXTURE0 + 5);
-        landscapeShader.set_uniform("shadowMap3", 5);
-        glBindTexture(GL_TEXTURE_2D, shadowDepthTextures[2]);
-
-        DrawLandscape(landscape, landscapeShader);
+        glActiveTexture(GL_TEXTURE0 + 6);
+        landscapeShader.set_uniform("horizonMap", 6);
+        glBindTexture(GL_TEXTURE_2D, horizonTexture);
+        landscapeShader.set_uniform("useHorizonMap", useHorizonMap);
+        landscapeShader.set_uniform("terrainScale", (float) landscape.scale);
+        glActiveTexture(GL_TEXTURE0 + 7);
+        landscapeShader.set_uniform("albedoClipmap", 7);
+        glBindTexture(GL_TEXTURE_2D, albedoClipmapTexture);
+        CountTextureBinds(2);
+        landscapeShader.set_uniform("useAlbedoClipmap", useAlbedoClipmap);
+        landscapeShader.set_uniform("albedoClipmapMin", albedoClipmapMin.x, albedoClipmapMin.y);
+        landscapeShader.set_uniform("albedoClipmapMax", albedoClipmapMax.x, albedoClipmapMax.y);
+        landscapeShader.set_uniform("albedoClipmapExtent", albedoClipmapExtent);
+
+        DrawLandscape(landscape, landscapeShader, useReducedLandscape);
         worldModel = glm::translate(worldModel, glm::vec3(0, 0.05, 0));
 
-        modelShader.use();
         worldModel = glm::translate(worldModel, lighthouse.position);
+        bool lighthouseTested = BeginModelOcclusionTest("lighthouse", lighthouse, lighthouseBoundsMin, lighthouseBoundsMax);
+        modelShader.use();
         modelShader.set_uniform("model", glm::value_ptr(worldModel));
         modelShader.set_uniform("view", glm::value_ptr(View));
         modelShader.set_uniform("projection", glm::value_ptr(Projection));
+        SetShadowUniforms(modelShader);
 
         modelShader.set_uniform("sunPosition", sun.direction.x, sun.direction.y, sun.direction.z);
         modelShader.set_uniform("projectorPosition", projector.position.x, projector.position.y, projector.position.z);
@@ -152,20 +195,25 @@ public:
         modelShader.set_uniform("waterNormal", waterNormal);
         modelShader.set_uniform("cameraPosition", cameraPos.x, cameraPos.y, cameraPos.z);
         DrawModel(lighthouse, modelShader);
+        if (lighthouseTested) {
+            EndOcclusionTest(*occlusion);
+        }
 
-        simpleShader.use();
-        glBindVertexArray(cube);
         worldModel = glm::translate(worldModel, -lighthouse.position);
-        worldModel = glm::translate(worldModel, projector.position);
-        simpleShader.set_uniform("model", glm::value_ptr(worldModel));
-        simpleShader.set_uniform("view", glm::value_ptr(View));
-        simpleShader.set_uniform("projection", glm::value_ptr(Projection));
-        simpleShader.set_uniform("waterLevel", waterLevel);
-        simpleShader.set_uniform("waterNormal", waterNormal);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-
-        worldModel = glm::translate(worldModel, -projector.position);
+        if (drawProjectorCube) {
+            simpleShader.use();
+            glBindVertexArray(cube);
+            worldModel = glm::translate(worldModel, projector.position);
+            simpleShader.set_uniform("model", glm::value_ptr(worldModel));
+            simpleShader.set_uniform("view", glm::value_ptr(View));
+            simpleShader.set_uniform("projection", glm::value_ptr(Projection));
+            simpleShader.set_uniform("waterLevel", waterLevel);
+            simpleShader.set_uniform("waterNormal", waterNormal);
+            CountDraw(12);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glBindVertexArray(0);
+            worldModel = glm::translate(worldModel, -projector.position);
+        }
 
         glm::mat4 cubemapView = glm::mat4(glm::mat3(View));
         glm::mat4 vp = Projection * cubemapView;
@@ -177,6 +225,7 @@ public:
         worldModel = glm::translate(worldModel, boat.position);
         worldModel = glm::rotate(worldModel, 3.1415f, glm::vec3(0.0, 1.0, 0.0));
         worldModel = glm::rotate(worldModel, boatRotation + 3.1415f / 2, glm::vec3(0.0, 1.0, 0.0));
+        bool boatTested = BeginModelOcclusionTest("boat", boat, boatBoundsMin, boatBoundsMax);
         modelShader.use();
         modelShader.set_uniform("model", glm::value_ptr(worldModel));
         modelShader.set_uniform("view", glm::value_ptr(View));
@@ -190,42 +239,61 @@ public:
         modelShader.set_uniform("waterNormal", waterNormal);
         modelShader.set_uniform("cameraPosition", cameraPos.x, cameraPos.y, cameraPos.z);
         DrawModel(boat, modelShader);
+        if (boatTested) {
+            EndOcclusionTest(*occlusion);
+        }
         worldModel = glm::rotate(worldModel, -3.1415f, glm::vec3(0.0, 1.0, 0.0));
         worldModel = glm::rotate(worldModel, -boatRotation - 3.1415f / 2, glm::vec3(0.0, 1.0, 0.0));
         worldModel = glm::translate(worldModel, glm::vec3(0, 0.07, 0));
         worldModel = glm::translate(worldModel, -boat.position);
     }
 
-    void DrawShadows() {
-        landscapeShaderShadow.use();
-        worldModel = glm::translate(worldModel, glm::vec3(0, -0.05, 0));
-        landscapeShaderShadow.set_uniform("model", glm::value_ptr(worldModel));
-        landscapeShaderShadow.set_uniform("view", glm::value_ptr(View));
-        landscapeShaderShadow.set_uniform("projection", glm::value_ptr(Projection));
-
-        DrawLandscape(landscape, landscapeShaderShadow);
-        worldModel = glm::translate(worldModel, glm::vec3(0, 0.05, 0));
+    // Casters go through shadow_cascades.gs, which applies the shadow view matrices
+    // and only writes the views in shadowViewMask; View and Projection are
+    // expected to be identity here.
+
+    // Casters that never move: the landscape, the lighthouse and the projector housing.
+    // The sun skips the landscape when its self-shadowing comes from the horizon map.
+    void DrawStaticShadows(bool withLandscape) {
+        TRACE_ZONE("Scene::DrawStaticShadows");
+        if (withLandscape) {
+            landscapeShaderShadow.use();
+            worldModel = glm::translate(worldModel, glm::vec3(0, -0.05, 0));
+            landscapeShaderShadow.set_uniform("model", glm::value_ptr(worldModel));
+            landscapeShaderShadow.set_uniform("view", glm::value_ptr(View));
+            landscapeShaderShadow.set_uniform("projection", glm::value_ptr(Projection));
+            landscapeShaderShadow.set_uniform("viewMask", shadowViewMask);
+
+            DrawLandscape(landscape, landscapeShaderShadow);
+            worldModel = glm::translate(worldModel, glm::vec3(0, 0.05, 0));
+        }
 
         modelShaderShadow.use();
         worldModel = glm::translate(worldModel, lighthouse.position);
         modelShaderShadow.set_uniform("model", glm::value_ptr(worldModel));
         modelShaderShadow.set_uniform("view", glm::value_ptr(View));
         modelShaderShadow.set_uniform("projection", glm::value_ptr(Projection));
+        modelShaderShadow.set_uniform("viewMask", shadowViewMask);
 
         DrawModel(lighthouse, modelShaderShadow);
         worldModel = glm::translate(worldModel, -lighthouse.position);
 
-        simpleShader.use();
+        simpleShaderShadow.use();
         glBindVertexArray(cube);
         worldModel = glm::translate(worldModel, projector.position);
-        simpleShader.set_uniform("model", glm::value_ptr(worldModel));
-        simpleShader.set_uniform("view", glm::value_ptr(View));
-        simpleShader.set_uniform("projection", glm::value_ptr(Projection));
+        simpleShaderShadow.set_uniform("model", glm::value_ptr(worldModel));
+        simpleShaderShadow.set_uniform("view", glm::value_ptr(View));
+        simpleShaderShadow.set_uniform("projection", glm::value_ptr(Projection));
+        simpleShaderShadow.set_uniform("viewMask", shadowViewMask);
+        CountDraw(12);
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
 
         worldModel = glm::translate(worldModel, -projector.position);
+    }
 
+    void DrawDynamicShadows() {
+        TRACE_ZONE("Scene::DrawDynamicShadows");
         worldModel = glm::translate(worldModel, glm::vec3(0, -0.07, 0));
         worldModel = glm::translate(worldModel, boat.position);
         worldModel = glm::rotate(worldModel, 3.1415f, glm::vec3(0.0, 1.0, 0.0));
@@ -234,6 +302,7 @@ public:
         modelShaderShadow.set_uniform("model", glm::value_ptr(worldModel));
         modelShaderShadow.set_uniform("view", glm::value_ptr(View));
         modelShaderShadow.set_uniform("projection", glm::value_ptr(Projection));
+        modelShaderShadow.set_uniform("viewMask", shadowViewMask);
 
         DrawModel(boat, modelShaderShadow);
         worldModel = glm::rotate(worldModel, -3.1415f, glm::vec3(0.0, 1.0, 0.0));
@@ -241,6 +310,48 @@ public:
         worldModel = glm::translate(worldModel, glm::vec3(0, 0.07, 0));
         worldModel = glm::translate(worldModel, -boat.position);
     }
+
+private:
+    // Tests the bounds of a model about to be drawn under worldModel, see BeginOcclusionTest
+    bool BeginModelOcclusionTest(const std::string& name, const Model& model, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+        if (occlusion == nullptr || !occlusion->enabled) {
+            return false;
+        }
+        simpleShader.use();
+        simpleShader.set_uniform("waterLevel", waterLevel);
+        simpleShader.set_uniform("waterNormal", waterNormal);
+        return BeginOcclusionTest(*occlusion, occlusionPass + "/" + name, simpleShader, worldModel, View, Projection,
+                                  boundsMin, boundsMax, cameraPos, (int) model.meshes.size());
+    }
+
+    // Above the units DrawMesh hands out to model textures
+    static const int kShadowMapUnit = 8;
+    static const int kShadowMomentsUnit = 9;
+    static const int kProjectorShadowUnit = 10;
+
+    // Everything shadow_cascades.glsl reads
+    void SetShadowUniforms(shader_t& shader) {
+        shader.set_uniform("receiveShadows", receiveShadows);
+        shader.set_uniform("plane1", planes[1]);
+        shader.set_uniform("plane2", planes[2]);
+        shader.set_uniform("plane3", planes[3]);
+        shader.set_uniform("cascadeBlend", shadowCascadeBlend);
+        shader.set_uniform("projectorShadowView", projectorShadowView);
+        glActiveTexture(GL_TEXTURE0 + kShadowMapUnit);
+        shader.set_uniform("shadowAtlas", kShadowMapUnit);
+        glBindTexture(GL_TEXTURE_2D, shadowAtlas);
+        glActiveTexture(GL_TEXTURE0 + kShadowMomentsUnit);
+        shader.set_uniform("shadowMoments", kShadowMomentsUnit);
+        glBindTexture(GL_TEXTURE_2D, shadowMomentsAtlas);
+        glActiveTexture(GL_TEXTURE0 + kProjectorShadowUnit);
+        shader.set_uniform("projectorShadowCube", kProjectorShadowUnit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, projectorShadowCube);
+        CountTextureBinds(3);
+        shader.set_uniform("projectorShadowDepth", projectorShadowNear, projectorShadowFar);
+        shader.set_uniform("useShadowMoments", useShadowMoments);
+        shader.set_uniform("shadowExponent", shadowExponent);
+        glActiveTexture(GL_TEXTURE0);
+    }
 };
 
 void LoadModel(Model& model,
@@ -268,6 +379,23 @@ void LoadLandscape(Landscape& landscape,
                    float grassThreshold,
                    int scale);
 
+// Builds the landscape from width * height normalized heights (row-major), e.g. from GenerateHeightMap.
+void CreateLandscape(Landscape& landscape,
+                     const std::vector<float>& heights,
+                     int width,
+                     int height,
+                     const std::string sand_path,
+                     const std::string grass_path,
+                     const std::string rock_path,
+                     float heightCoefficient,
+                     int texture_density,
+                     float sandThreshold,
+                     float grassThreshold,
+                     int scale);
+
+// Model-space bounding box of all mesh vertices
+void ModelBounds(Model& model, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
 float GetHeight(Landscape& landscape, int x, int z);
 
 unsigned int CreateFrameBuffer();
@@ -278,8 +406,15 @@ unsigned int BindFrameBuffer(unsigned int FBO, int height, int width);
 
 unsigned int CreateShadowBuffer(unsigned int shadowWidth, unsigned int shadowHeight, std::vector<unsigned int>& shadowMaps);
 
+// Practical split scheme: lambda blends logarithmic (1) and uniform (0) splits
+void CalculateCascadeSplits(std::vector<float>& cascadePlanes, int cascades, float nearPlane, float farPlane, float lambda);
+
+// Fits a texel-snapped bounding square around each frustum slice; the depth range
+// comes from the scene bounds so casters outside the view are kept. resolutions
+// holds the texel size of every cascade's shadow region.
 void CalculateCascades(std::vector<glm::mat4>& lightOrtos, std::vector<float>& cascadePlanes, glm::mat4 cameraView,
-                       glm::mat4 lightView, int display_w, int display_h, float displayAngle);
+                       glm::mat4 lightView, int display_w, int display_h, float displayAngle,
+                       const std::vector<int>& resolutions, glm::vec3 sceneMin, glm::vec3 sceneMax);
 
 
 glm::mat4 CalculateOblique(glm::mat4 cameraProjection, glm::vec4 plane);
\ No newline at end of file
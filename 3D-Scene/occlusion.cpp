@@ -0,0 +1,146 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <GL/glew.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "imgui.h"
+#include "model.h"
+#include "render_stats.h"
+
+namespace {
+    // Tests that haven't run for this many frames belong to culled passes; the
+    // window hides them
+    const int kStaleFrames = 30;
+
+    // Keeps the camera's near plane (0.1) clear of the box
+    const float kCameraMargin = 0.2f;
+}
+
+void CreateOcclusionCulling(OcclusionCulling& occlusion) {
+    occlusion.box = LoadCubeVertices(1.0f);
+}
+
+void DeleteOcclusionCulling(OcclusionCulling& occlusion) {
+    for (auto& entry : occlusion.queries) {
+        glDeleteQueries(OcclusionQuery::kQuerySlots, entry.second.queries);
+    }
+    occlusion.queries.clear();
+    glDeleteVertexArrays(1, &occlusion.box);
+    occlusion.box = 0;
+}
+
+void BeginOcclusionFrame(OcclusionCulling& occlusion) {
+    occlusion.frame++;
+    occlusion.testedMeshes = 0;
+    occlusion.occludedMeshes = 0;
+    for (auto& entry : occlusion.queries) {
+        OcclusionQuery& query = entry.second;
+        for (int slot = 0; slot < OcclusionQuery::kQuerySlots; slot++) {
+            if (!query.pending[slot]) {
+                continue;
+            }
+            GLint available = 0;
+            glGetQueryObjectiv(query.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                continue;
+            }
+            GLuint passed = 0;
+            glGetQueryObjectuiv(query.queries[slot], GL_QUERY_RESULT, &passed);
+            query.pending[slot] = false;
+            query.visible = passed != 0;
+            occlusion.testedMeshes += query.meshes;
+            occlusion.occludedMeshes += query.visible ? 0 : query.meshes;
+        }
+    }
+}
+
+bool BeginOcclusionTest(OcclusionCulling& occlusion, const std::string& name, shader_t& shader,
+                        const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+                        glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 cameraPos, int meshes) {
+    if (!occlusion.enabled) {
+        return false;
+    }
+
+    glm::mat4 boxModel = model * glm::translate(0.5f * (boundsMin + boundsMax)) * glm::scale(0.5f * (boundsMax - boundsMin));
+    glm::vec3 worldMin(std::numeric_limits<float>::max());
+    glm::vec3 worldMax(-std::numeric_limits<float>::max());
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec4 position = boxModel * glm::vec4(corner & 1 ? 1 : -1, corner & 2 ? 1 : -1, corner & 4 ? 1 : -1, 1);
+        worldMin = glm::min(worldMin, glm::vec3(position));
+        worldMax = glm::max(worldMax, glm::vec3(position));
+    }
+    bool cameraInside = true;
+    for (int axis = 0; axis < 3; axis++) {
+        cameraInside &= cameraPos[axis] > worldMin[axis] - kCameraMargin && cameraPos[axis] < worldMax[axis] + kCameraMargin;
+    }
+    if (cameraInside) {
+        return false;
+    }
+
+    auto found = occlusion.queries.find(name);
+    if (found == occlusion.queries.end()) {
+        OcclusionQuery query;
+        glGenQueries(OcclusionQuery::kQuerySlots, query.queries);
+        found = occlusion.queries.emplace(name, query).first;
+    }
+    OcclusionQuery& query = found->second;
+    query.lastFrame = occlusion.frame;
+    query.meshes = meshes;
+    query.slot = -1;
+    for (int slot = 0; slot < OcclusionQuery::kQuerySlots; slot++) {
+        if (!query.pending[slot]) {
+            query.slot = slot;
+            break;
+        }
+    }
+    if (query.slot < 0) {
+        return false;
+    }
+
+    shader.use();
+    shader.set_uniform("model", glm::value_ptr(boxModel));
+    shader.set_uniform("view", glm::value_ptr(view));
+    shader.set_uniform("projection", glm::value_ptr(projection));
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, query.queries[query.slot]);
+    glBindVertexArray(occlusion.box);
+    CountDraw(12);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindVertexArray(0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    query.pending[query.slot] = true;
+
+    // The GPU waits for its own result, which is right behind; the CPU goes on
+    glBeginConditionalRender(query.queries[query.slot], GL_QUERY_WAIT);
+    occlusion.running = &query;
+    return true;
+}
+
+void EndOcclusionTest(OcclusionCulling& occlusion) {
+    if (occlusion.running == nullptr) {
+        return;
+    }
+    glEndConditionalRender();
+    occlusion.running = nullptr;
+}
+
+void DrawOcclusionWindow(OcclusionCulling& occlusion) {
+    ImGui::Begin("Occlusion");
+    ImGui::Checkbox("Enabled", &occlusion.enabled);
+    ImGui::Text("Meshes occluded: %d of %d tested", occlusion.occludedMeshes, occlusion.testedMeshes);
+    ImGui::Separator();
+    for (const auto& entry : occlusion.queries) {
+        if (occlusion.frame - entry.second.lastFrame > kStaleFrames) {
+            continue;
+        }
+        ImGui::Text("%s: %s", entry.first.c_str(), entry.second.visible ? "visible" : "occluded");
+    }
+    ImGui::End();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "opengl_shader.h"
+
+// Hardware occlusion culling of models drawn after their occluders (the terrain,
+// the lighthouse): the model's bounding box is rasterized against the depth
+// buffer so far, with color and depth writes off, inside a GL_ANY_SAMPLES_PASSED
+// query, and the model is drawn under glBeginConditionalRender on that query.
+// The GPU drops the draws when no sample of the box passed; the CPU never waits.
+// The results are also read back a frame or two later, once available, for the
+// occlusion counts.
+struct OcclusionQuery {
+    static const int kQuerySlots = 3;
+    unsigned int queries[kQuerySlots] = {};
+    bool pending[kQuerySlots] = {};
+    int slot = -1;                  // slot of the running test, -1 when skipped
+    int meshes = 0;                 // meshes the test decides on
+    bool visible = true;            // newest result read back
+    long long lastFrame = -1;       // last frame the test ran
+};
+
+struct OcclusionCulling {
+    bool enabled = true;
+    unsigned int box = 0;           // cube over [-1, 1]^3
+
+    long long frame = 0;
+    std::map<std::string, OcclusionQuery> queries;
+    OcclusionQuery* running = nullptr;
+
+    // Meshes whose results were read back at the start of this frame, i.e. of
+    // tests from a frame or two ago
+    int testedMeshes = 0;
+    int occludedMeshes = 0;
+};
+
+void CreateOcclusionCulling(OcclusionCulling& occlusion);
+void DeleteOcclusionCulling(OcclusionCulling& occlusion);
+
+// Reads back the finished results; call once at the start of every frame.
+void BeginOcclusionFrame(OcclusionCulling& occlusion);
+
+// Tests the box boundsMin..boundsMax under model with shader, which needs model,
+// view and projection uniforms, and starts conditional rendering on the result.
+// Returns false, and the model is drawn unconditionally, while disabled, when
+// the camera is in or right next to the box (whose near faces would be clipped)
+// or when all of the test's queries are still in flight. Leaves shader in use.
+bool BeginOcclusionTest(OcclusionCulling& occlusion, const std::string& name, shader_t& shader,
+                        const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+                        glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 cameraPos, int meshes);
+
+// Ends the conditional rendering of a test that BeginOcclusionTest started
+void EndOcclusionTest(OcclusionCulling& occlusion);
+
+// Per test whether its model was hidden last, and the occluded mesh count
+void DrawOcclusionWindow(OcclusionCulling& occlusion);
@@ -4,6 +4,8 @@
 #include <sstream>
 #include <iostream>
 
+#include "render_stats.h"
+
 namespace {
     std::string read_shader_code(const std::string &fname) {
         std::stringstream file_stream;
@@ -14,8 +16,29 @@ namespace {
         catch (std::exception const &e) {
             std::cerr << "Error reading shader file: " << e.what() << std::endl;
         }
-        return file_stream.str();
 
+        // Resolve #include "file" lines relative to the including shader, so
+        // shaders can share GLSL snippets.
+        const std::string directive = "#include";
+        const size_t slash = fname.find_last_of('/');
+        const std::string directory = slash == std::string::npos ? "" : fname.substr(0, slash + 1);
+
+        std::stringstream code;
+        std::string line;
+        while (std::getline(file_stream, line)) {
+            size_t start = line.find_first_not_of(" \t");
+            if (start != std::string::npos && line.compare(start, directive.size(), directive) == 0) {
+                size_t open = line.find('"', start);
+                size_t close = line.find('"', open + 1);
+                if (open != std::string::npos && close != std::string::npos) {
+                    code << read_shader_code(directory + line.substr(open + 1, close - open - 1)) << "\n";
+                    continue;
+                }
+                std::cerr << "Malformed include in " << fname << ": " << line << std::endl;
+            }
+            code << line << "\n";
+        }
+        return code.str();
     }
 }
 
@@ -28,6 +51,16 @@ shader_t::shader_t(const std::string &vertex_code_fname, const std::string &frag
     link();
 }
 
+shader_t::shader_t(const std::string &vertex_code_fname, const std::string &geometry_code_fname,
+                   const std::string &fragment_code_fname) {
+    const auto vertex_code = read_shader_code(vertex_code_fname);
+    const auto geometry_code = read_shader_code(geometry_code_fname);
+    const auto fragment_code = read_shader_code(fragment_code_fname);
+    compile(vertex_code, fragment_code);
+    compile_geometry(geometry_code);
+    link();
+}
+
 shader_t::~shader_t() {
 }
 
@@ -44,50 +77,85 @@ void shader_t::compile(const std::string &vertex_code, const std::string &fragme
     check_compile_error();
 }
 
+void shader_t::compile_geometry(const std::string &geometry_code) {
+    const char *gcode = geometry_code.c_str();
+    geometry_id_ = glCreateShader(GL_GEOMETRY_SHADER);
+    glShaderSource(geometry_id_, 1, &gcode, NULL);
+    glCompileShader(geometry_id_);
+
+    int success;
+    char infoLog[1024];
+    glGetShaderiv(geometry_id_, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(geometry_id_, 1024, NULL, infoLog);
+        std::cerr << "Error compiling Geometry shader_t:\n" << infoLog << std::endl;
+    }
+}
+
 void shader_t::link() {
     program_id_ = glCreateProgram();
     glAttachShader(program_id_, vertex_id_);
+    if (geometry_id_) {
+        glAttachShader(program_id_, geometry_id_);
+    }
     glAttachShader(program_id_, fragment_id_);
     glLinkProgram(program_id_);
     check_linking_error();
     glDeleteShader(vertex_id_);
+    if (geometry_id_) {
+        glDeleteShader(geometry_id_);
+    }
     glDeleteShader(fragment_id_);
 }
 
 void shader_t::use() {
+    CountProgramUse(program_id_);
     glUseProgram(program_id_);
 }
 
 template<>
 void shader_t::set_uniform<int>(const std::string &name, int val) {
+    CountUniformUpload();
     glUniform1i(glGetUniformLocation(program_id_, name.c_str()), val);
 }
 
 template<>
 void shader_t::set_uniform<bool>(const std::string &name, bool val) {
+    CountUniformUpload();
     glUniform1i(glGetUniformLocation(program_id_, name.c_str()), val);
 }
 
 template<>
 void shader_t::set_uniform<float>(const std::string &name, float val) {
+    CountUniformUpload();
     glUniform1f(glGetUniformLocation(program_id_, name.c_str()), val);
 }
 
 template<>
 void shader_t::set_uniform<float>(const std::string &name, float val1, float val2) {
+    CountUniformUpload();
     glUniform2f(glGetUniformLocation(program_id_, name.c_str()), val1, val2);
 }
 
 template<>
 void shader_t::set_uniform<float>(const std::string &name, float val1, float val2, float val3) {
+    CountUniformUpload();
     glUniform3f(glGetUniformLocation(program_id_, name.c_str()), val1, val2, val3);
 }
 
 template<>
 void shader_t::set_uniform<float *>(const std::string &name, float *val) {
+    CountUniformUpload();
     glUniformMatrix4fv(glGetUniformLocation(program_id_, name.c_str()), 1, GL_FALSE, val);
 }
 
+void shader_t::bind_uniform_block(const std::string &name, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(program_id_, name.c_str());
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program_id_, index, binding);
+    }
+}
+
 void shader_t::check_compile_error() {
     int success;
     char infoLog[1024];
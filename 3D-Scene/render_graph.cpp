@@ -0,0 +1,344 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+    size_t BytesPerTexel(GLenum format) {
+        switch (format) {
+            case GL_NONE:
+                return 0;
+            case GL_RGBA16F:
+            case GL_RG32F:
+                return 8;
+            case GL_RGBA32F:
+                return 16;
+            default:
+                // RGB8 is padded to four bytes, depth formats take four with or without stencil
+                return 4;
+        }
+    }
+
+    size_t TargetBytes(const RenderTargetDesc& desc) {
+        return (size_t) desc.width * desc.height * (BytesPerTexel(desc.colorFormat) + BytesPerTexel(desc.depthFormat));
+    }
+
+    bool IsFloatFormat(GLenum format) {
+        return format == GL_RGBA16F || format == GL_RG32F || format == GL_RGBA32F
+               || format == GL_R32F || format == GL_RGB16F;
+    }
+
+    unsigned int CreateTargetTexture(int width, int height, GLenum internalFormat, GLenum format, GLenum type) {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    void CreateTarget(RenderGraphTarget& target, const RenderTargetDesc& desc, const std::string& name) {
+        target.desc = desc;
+        glGenFramebuffers(1, &target.frameBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.frameBuffer);
+
+        if (desc.colorFormat != GL_NONE) {
+            GLenum type = IsFloatFormat(desc.colorFormat) ? GL_FLOAT : GL_UNSIGNED_BYTE;
+            target.colorTexture = CreateTargetTexture(desc.width, desc.height, desc.colorFormat, GL_RGBA, type);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.colorTexture, 0);
+            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+        } else {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        if (desc.depthFormat != GL_NONE) {
+            target.depthTexture = CreateTargetTexture(desc.width, desc.height, desc.depthFormat,
+                                                      GL_DEPTH_COMPONENT, GL_FLOAT);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target.depthTexture, 0);
+        }
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Render graph target " << name << " is incomplete" << std::endl;
+            exit(1);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void DeleteTarget(RenderGraphTarget& target) {
+        glDeleteFramebuffers(1, &target.frameBuffer);
+        if (target.colorTexture) {
+            glDeleteTextures(1, &target.colorTexture);
+        }
+        if (target.depthTexture) {
+            glDeleteTextures(1, &target.depthTexture);
+        }
+        target = RenderGraphTarget();
+    }
+
+    std::string Shape(const RenderGraph& graph) {
+        std::string shape;
+        for (const RenderGraphResource& resource : graph.resources) {
+            shape += resource.name + (resource.imported ? "=i" : "=t")
+                     + std::to_string(resource.desc.width) + "x" + std::to_string(resource.desc.height)
+                     + ":" + std::to_string(resource.desc.colorFormat)
+                     + ":" + std::to_string(resource.desc.depthFormat) + ";";
+        }
+        for (const RenderGraphPass& pass : graph.passes) {
+            shape += pass.name + (pass.sideEffects ? "!" : "") + "(";
+            for (int r : pass.reads) {
+                shape += std::to_string(r) + ",";
+            }
+            shape += ")->(";
+            for (int w : pass.writes) {
+                shape += std::to_string(w) + ",";
+            }
+            shape += ");";
+        }
+        return shape;
+    }
+
+    void ResolveTargets(RenderGraph& graph) {
+        for (size_t i = 0; i < graph.resources.size(); i++) {
+            RenderGraphResource& resource = graph.resources[i];
+            resource.firstPass = graph.compiledFirstPass[i];
+            resource.lastPass = graph.compiledLastPass[i];
+            if (resource.imported) {
+                continue;
+            }
+            resource.target = graph.compiledTargets[i];
+            if (resource.target >= 0) {
+                const RenderGraphTarget& target = graph.targets[resource.target];
+                resource.frameBuffer = target.frameBuffer;
+                resource.colorTexture = target.colorTexture;
+                resource.depthTexture = target.depthTexture;
+            }
+        }
+    }
+}
+
+bool operator==(const RenderTargetDesc& a, const RenderTargetDesc& b) {
+    return a.width == b.width && a.height == b.height
+           && a.colorFormat == b.colorFormat && a.depthFormat == b.depthFormat;
+}
+
+void BeginRenderGraph(RenderGraph& graph) {
+    graph.resources.clear();
+    graph.passes.clear();
+}
+
+int ImportRenderTarget(RenderGraph& graph, const std::string& name,
+                       unsigned int frameBuffer, unsigned int colorTexture, unsigned int depthTexture) {
+    RenderGraphResource resource;
+    resource.name = name;
+    resource.imported = true;
+    resource.frameBuffer = frameBuffer;
+    resource.colorTexture = colorTexture;
+    resource.depthTexture = depthTexture;
+    graph.resources.push_back(resource);
+    return (int) graph.resources.size() - 1;
+}
+
+int CreateRenderTarget(RenderGraph& graph, const std::string& name, const RenderTargetDesc& desc) {
+    RenderGraphResource resource;
+    resource.name = name;
+    resource.desc = desc;
+    graph.resources.push_back(resource);
+    return (int) graph.resources.size() - 1;
+}
+
+void AddRenderPass(RenderGraph& graph, const std::string& name,
+                   const std::vector<int>& reads, const std::vector<int>& writes,
+                   std::function<void()> execute, bool sideEffects) {
+    RenderGraphPass pass;
+    pass.name = name;
+    pass.reads = reads;
+    pass.writes = writes;
+    pass.execute = execute;
+    pass.sideEffects = sideEffects;
+    graph.passes.push_back(pass);
+}
+
+void CompileRenderGraph(RenderGraph& graph) {
+    std::string shape = Shape(graph);
+    if (shape == graph.compiledShape) {
+        for (size_t i = 0; i < graph.passes.size(); i++) {
+            graph.passes[i].culled = graph.compiledCulled[i];
+        }
+        ResolveTargets(graph);
+        return;
+    }
+    graph.compiledShape = shape;
+    graph.compilations++;
+
+    // Walking backwards, a pass is needed when it has side effects or writes
+    // something a needed pass reads
+    std::vector<bool> needed(graph.resources.size(), false);
+    for (int p = (int) graph.passes.size() - 1; p >= 0; p--) {
+        RenderGraphPass& pass = graph.passes[p];
+        bool keep = pass.sideEffects;
+        for (int w : pass.writes) {
+            keep = keep || needed[w];
+        }
+        pass.culled = !keep;
+        if (keep) {
+            for (int r : pass.reads) {
+                needed[r] = true;
+            }
+        }
+    }
+
+    std::vector<bool> written(graph.resources.size(), false);
+    for (RenderGraphResource& resource : graph.resources) {
+        resource.firstPass = -1;
+        resource.lastPass = -1;
+    }
+    for (int p = 0; p < (int) graph.passes.size(); p++) {
+        const RenderGraphPass& pass = graph.passes[p];
+        if (pass.culled) {
+            continue;
+        }
+        for (int r : pass.reads) {
+            if (!graph.resources[r].imported && !written[r]) {
+                std::cerr << "Render pass " << pass.name << " reads " << graph.resources[r].name
+                          << " before any pass writes it" << std::endl;
+                exit(1);
+            }
+        }
+        for (int w : pass.writes) {
+            written[w] = true;
+        }
+        for (const std::vector<int>* list : {&pass.reads, &pass.writes}) {
+            for (int r : *list) {
+                RenderGraphResource& resource = graph.resources[r];
+                if (resource.firstPass < 0) {
+                    resource.firstPass = p;
+                }
+                resource.lastPass = p;
+            }
+        }
+    }
+
+    // Transient targets in order of first use; each takes the first pool target
+    // with the same description that is free by then
+    std::vector<int> transients;
+    for (int i = 0; i < (int) graph.resources.size(); i++) {
+        if (!graph.resources[i].imported && graph.resources[i].firstPass >= 0) {
+            transients.push_back(i);
+        }
+    }
+    std::stable_sort(transients.begin(), transients.end(), [&](int a, int b) {
+        return graph.resources[a].firstPass < graph.resources[b].firstPass;
+    });
+
+    std::vector<int> busyUntil(graph.targets.size(), -1);
+    std::vector<bool> used(graph.targets.size(), false);
+    graph.compiledTargets.assign(graph.resources.size(), -1);
+    for (int i : transients) {
+        RenderGraphResource& resource = graph.resources[i];
+        int slot = -1;
+        for (int t = 0; t < (int) graph.targets.size(); t++) {
+            if (graph.targets[t].frameBuffer != 0 && graph.targets[t].desc == resource.desc
+                && busyUntil[t] < resource.firstPass) {
+                slot = t;
+                break;
+            }
+        }
+        if (slot < 0) {
+            for (int t = 0; t < (int) graph.targets.size(); t++) {
+                if (graph.targets[t].frameBuffer == 0) {
+                    slot = t;
+                    break;
+                }
+            }
+            if (slot < 0) {
+                graph.targets.emplace_back();
+                busyUntil.push_back(-1);
+                used.push_back(false);
+                slot = (int) graph.targets.size() - 1;
+            }
+            CreateTarget(graph.targets[slot], resource.desc, resource.name);
+        }
+        busyUntil[slot] = resource.lastPass;
+        used[slot] = true;
+        graph.compiledTargets[i] = slot;
+    }
+
+    // Whatever the new plan doesn't use goes back to the driver
+    for (size_t t = 0; t < graph.targets.size(); t++) {
+        if (!used[t] && graph.targets[t].frameBuffer != 0) {
+            DeleteTarget(graph.targets[t]);
+        }
+    }
+
+    graph.compiledCulled.clear();
+    for (const RenderGraphPass& pass : graph.passes) {
+        graph.compiledCulled.push_back(pass.culled);
+    }
+    graph.compiledFirstPass.clear();
+    graph.compiledLastPass.clear();
+    for (const RenderGraphResource& resource : graph.resources) {
+        graph.compiledFirstPass.push_back(resource.firstPass);
+        graph.compiledLastPass.push_back(resource.lastPass);
+    }
+    ResolveTargets(graph);
+}
+
+void ExecuteRenderGraph(RenderGraph& graph, GpuProfiler& profiler, RenderStats& stats) {
+    for (RenderGraphPass& pass : graph.passes) {
+        if (pass.culled) {
+            continue;
+        }
+        BeginProfilerZone(profiler, pass.name);
+        BeginRenderStatsPass(stats, pass.name);
+        pass.execute();
+        EndRenderStatsPass(stats);
+        EndProfilerZone(profiler);
+    }
+}
+
+unsigned int RenderGraphFrameBuffer(const RenderGraph& graph, int resource) {
+    return graph.resources[resource].frameBuffer;
+}
+
+unsigned int RenderGraphColorTexture(const RenderGraph& graph, int resource) {
+    return graph.resources[resource].colorTexture;
+}
+
+unsigned int RenderGraphDepthTexture(const RenderGraph& graph, int resource) {
+    return graph.resources[resource].depthTexture;
+}
+
+size_t RenderGraphTransientMemory(const RenderGraph& graph) {
+    size_t bytes = 0;
+    for (const RenderGraphResource& resource : graph.resources) {
+        if (!resource.imported && resource.firstPass >= 0) {
+            bytes += TargetBytes(resource.desc);
+        }
+    }
+    return bytes;
+}
+
+size_t RenderGraphPoolMemory(const RenderGraph& graph) {
+    size_t bytes = 0;
+    for (const RenderGraphTarget& target : graph.targets) {
+        if (target.frameBuffer != 0) {
+            bytes += TargetBytes(target.desc);
+        }
+    }
+    return bytes;
+}
+
+void DeleteRenderGraph(RenderGraph& graph) {
+    for (RenderGraphTarget& target : graph.targets) {
+        if (target.frameBuffer != 0) {
+            DeleteTarget(target);
+        }
+    }
+    graph.targets.clear();
+    graph.compiledShape.clear();
+}
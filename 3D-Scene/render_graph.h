@@ -0,0 +1,102 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "gpu_profiler.h"
+#include "render_stats.h"
+
+// Frame description as passes with declared inputs and outputs. Every frame the
+// passes are declared again (their callbacks capture that frame's state), but the
+// declaration is only compiled when its shape changes:
+//  - passes whose outputs nobody reads are culled, unless they have side effects
+//    (presenting, CPU readback);
+//  - passes run in declaration order, which has to put writers before readers;
+//  - transient render targets are allocated from a pool, and targets with the
+//    same description whose lifetimes don't overlap share one allocation.
+// Every pass that runs is timed as a profiler zone of the same name, and its
+// API calls are counted as a render stats pass.
+
+struct RenderTargetDesc {
+    int width = 0;
+    int height = 0;
+    GLenum colorFormat = GL_NONE;   // internal format of the color attachment, GL_NONE for none
+    GLenum depthFormat = GL_NONE;   // internal format of the depth attachment, GL_NONE for none
+};
+
+bool operator==(const RenderTargetDesc& a, const RenderTargetDesc& b);
+
+struct RenderGraphResource {
+    std::string name;
+    bool imported = false;
+    RenderTargetDesc desc;          // transient targets only
+    unsigned int frameBuffer = 0;
+    unsigned int colorTexture = 0;
+    unsigned int depthTexture = 0;
+    int target = -1;                // pool slot of a transient target
+    int firstPass = -1;             // lifetime over the running passes
+    int lastPass = -1;
+};
+
+struct RenderGraphPass {
+    std::string name;
+    std::vector<int> reads;
+    std::vector<int> writes;
+    bool sideEffects = false;
+    std::function<void()> execute;
+    bool culled = false;
+};
+
+struct RenderGraphTarget {
+    RenderTargetDesc desc;
+    unsigned int frameBuffer = 0;
+    unsigned int colorTexture = 0;
+    unsigned int depthTexture = 0;
+};
+
+struct RenderGraph {
+    std::vector<RenderGraphResource> resources;
+    std::vector<RenderGraphPass> passes;
+    std::vector<RenderGraphTarget> targets;
+
+    std::string compiledShape;
+    std::vector<bool> compiledCulled;
+    std::vector<int> compiledTargets;
+    std::vector<int> compiledFirstPass;
+    std::vector<int> compiledLastPass;
+    int compilations = 0;
+};
+
+// Drops last frame's declarations; the compiled plan and target pool are kept.
+void BeginRenderGraph(RenderGraph& graph);
+
+// Targets owned elsewhere, e.g. persistent ones or the window. Returns a handle.
+int ImportRenderTarget(RenderGraph& graph, const std::string& name,
+                       unsigned int frameBuffer, unsigned int colorTexture = 0, unsigned int depthTexture = 0);
+
+// Targets that only live within the frame. Their framebuffer and textures are
+// valid while the passes using them run.
+int CreateRenderTarget(RenderGraph& graph, const std::string& name, const RenderTargetDesc& desc);
+
+void AddRenderPass(RenderGraph& graph, const std::string& name,
+                   const std::vector<int>& reads, const std::vector<int>& writes,
+                   std::function<void()> execute, bool sideEffects = false);
+
+// Culls, checks the order and assigns pool targets; reuses the previous plan when
+// the declaration has the same shape. Exits on passes reading what nobody wrote.
+void CompileRenderGraph(RenderGraph& graph);
+
+void ExecuteRenderGraph(RenderGraph& graph, GpuProfiler& profiler, RenderStats& stats);
+
+unsigned int RenderGraphFrameBuffer(const RenderGraph& graph, int resource);
+unsigned int RenderGraphColorTexture(const RenderGraph& graph, int resource);
+unsigned int RenderGraphDepthTexture(const RenderGraph& graph, int resource);
+
+// Bytes the transient targets would take without aliasing, and what the pool holds
+size_t RenderGraphTransientMemory(const RenderGraph& graph);
+size_t RenderGraphPoolMemory(const RenderGraph& graph);
+
+void DeleteRenderGraph(RenderGraph& graph);
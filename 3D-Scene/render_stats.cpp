@@ -0,0 +1,151 @@
+#include "render_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "imgui.h"
+
+RenderCounters renderCounters;
+
+namespace {
+    unsigned int currentProgram = 0;
+
+    void WriteRow(std::ofstream& csv, long long frame, const std::string& pass, const RenderCounters& c) {
+        csv << frame << "," << pass << "," << c.drawCalls << "," << c.triangles << "," << c.programSwitches << ","
+            << c.textureBinds << "," << c.uniformUploads << "," << c.frameBufferBinds << "," << c.uploadBytes << "\n";
+    }
+
+    // Nearest rank on sorted values
+    double Percentile(const std::vector<double>& sorted, double percent) {
+        int rank = (int) std::ceil(percent / 100.0 * sorted.size());
+        return sorted[std::max(0, std::min((int) sorted.size() - 1, rank - 1))];
+    }
+
+    void CountersRow(const char* name, const RenderCounters& c) {
+        ImGui::Text("%s", name);
+        ImGui::NextColumn();
+        for (long long value : {c.drawCalls, c.triangles, c.programSwitches, c.textureBinds,
+                                c.uniformUploads, c.frameBufferBinds, c.uploadBytes}) {
+            ImGui::Text("%lld", value);
+            ImGui::NextColumn();
+        }
+    }
+}
+
+RenderCounters operator-(const RenderCounters& a, const RenderCounters& b) {
+    RenderCounters c;
+    c.drawCalls = a.drawCalls - b.drawCalls;
+    c.triangles = a.triangles - b.triangles;
+    c.programSwitches = a.programSwitches - b.programSwitches;
+    c.textureBinds = a.textureBinds - b.textureBinds;
+    c.uniformUploads = a.uniformUploads - b.uniformUploads;
+    c.frameBufferBinds = a.frameBufferBinds - b.frameBufferBinds;
+    c.uploadBytes = a.uploadBytes - b.uploadBytes;
+    return c;
+}
+
+void CountProgramUse(unsigned int program) {
+    if (program != currentProgram) {
+        renderCounters.programSwitches++;
+        currentProgram = program;
+    }
+}
+
+void BeginRenderStatsFrame(RenderStats& stats) {
+    if (stats.frame > 0) {
+        stats.lastFrame = renderCounters - stats.frameStart;
+        stats.lastPasses.swap(stats.passes);
+        if (stats.csv.is_open()) {
+            for (const PassStats& pass : stats.lastPasses) {
+                WriteRow(stats.csv, stats.frame, pass.name, pass.counters);
+            }
+            WriteRow(stats.csv, stats.frame, "frame", stats.lastFrame);
+        }
+    }
+    stats.passes.clear();
+    stats.frameStart = renderCounters;
+    stats.frame++;
+}
+
+void BeginRenderStatsPass(RenderStats& stats, const std::string& name) {
+    PassStats pass;
+    pass.name = name;
+    stats.passes.push_back(pass);
+    stats.passStart = renderCounters;
+}
+
+void EndRenderStatsPass(RenderStats& stats) {
+    stats.passes.back().counters = renderCounters - stats.passStart;
+}
+
+bool StartRenderStatsCsv(RenderStats& stats, const std::string& path) {
+    stats.csv.open(path);
+    if (!stats.csv) {
+        std::cerr << "Can't write render stats to " << path << "\n";
+        return false;
+    }
+    stats.csvPath = path;
+    stats.csv << "frame,pass,draw_calls,triangles,program_switches,texture_binds,uniform_uploads,framebuffer_binds,upload_bytes\n";
+    return true;
+}
+
+void StopRenderStatsCsv(RenderStats& stats) {
+    if (stats.csv.is_open()) {
+        stats.csv.close();
+    }
+}
+
+void DrawRenderStatsWindow(RenderStats& stats) {
+    ImGui::Begin("Render stats");
+    if (stats.csv.is_open()) {
+        if (ImGui::Button("Stop CSV")) {
+            StopRenderStatsCsv(stats);
+        }
+        ImGui::SameLine();
+        ImGui::Text("Recording to %s", stats.csvPath.c_str());
+    } else if (ImGui::Button("Record CSV")) {
+        StartRenderStatsCsv(stats, "render_stats.csv");
+    }
+    ImGui::Separator();
+
+    ImGui::Columns(8, "counters");
+    for (const char* title : {"pass", "draws", "triangles", "programs", "textures", "uniforms", "framebuffers", "upload B"}) {
+        ImGui::Text("%s", title);
+        ImGui::NextColumn();
+    }
+    ImGui::Separator();
+    for (const PassStats& pass : stats.lastPasses) {
+        CountersRow(pass.name.c_str(), pass.counters);
+    }
+    ImGui::Separator();
+    CountersRow("frame", stats.lastFrame);
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+FrameTimeSummary SummarizeFrameTimes(std::vector<double> frameTimes) {
+    FrameTimeSummary summary;
+    summary.frames = (int) frameTimes.size();
+    if (frameTimes.empty()) {
+        return summary;
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+    double sum = 0;
+    for (double time : frameTimes) {
+        sum += time;
+    }
+    summary.average = sum / frameTimes.size();
+    summary.minimum = frameTimes.front();
+    summary.maximum = frameTimes.back();
+    summary.p50 = Percentile(frameTimes, 50);
+    summary.p95 = Percentile(frameTimes, 95);
+    summary.p99 = Percentile(frameTimes, 99);
+    return summary;
+}
+
+void PrintFrameTimeSummary(std::ostream& out, const FrameTimeSummary& summary) {
+    out << summary.frames << " frames, ms: avg " << summary.average << ", min " << summary.minimum
+        << ", p50 " << summary.p50 << ", p95 " << summary.p95 << ", p99 " << summary.p99
+        << ", max " << summary.maximum << "\n";
+}
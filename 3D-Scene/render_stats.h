@@ -0,0 +1,90 @@
+#pragma once
+
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// API call counters. The draw helpers in model.cpp, shader_t and the per-frame
+// framebuffer and buffer updates bump the running totals; RenderStats turns them
+// into per-frame and per-pass figures by taking differences.
+struct RenderCounters {
+    long long drawCalls = 0;
+    long long triangles = 0;
+    long long programSwitches = 0;
+    long long textureBinds = 0;
+    long long uniformUploads = 0;
+    long long frameBufferBinds = 0;
+    long long uploadBytes = 0;      // buffer and texture data sent from the CPU
+};
+
+RenderCounters operator-(const RenderCounters& a, const RenderCounters& b);
+
+extern RenderCounters renderCounters;
+
+inline void CountDraw(long long triangles) {
+    renderCounters.drawCalls++;
+    renderCounters.triangles += triangles;
+}
+
+inline void CountTextureBinds(long long binds) {
+    renderCounters.textureBinds += binds;
+}
+
+inline void CountUniformUpload() {
+    renderCounters.uniformUploads++;
+}
+
+inline void CountFrameBufferBind() {
+    renderCounters.frameBufferBinds++;
+}
+
+inline void CountUpload(long long bytes) {
+    renderCounters.uploadBytes += bytes;
+}
+
+// Counts a switch only when program differs from the one used last
+void CountProgramUse(unsigned int program);
+
+struct PassStats {
+    std::string name;
+    RenderCounters counters;
+};
+
+struct RenderStats {
+    long long frame = 0;
+    RenderCounters frameStart;
+    RenderCounters lastFrame;           // totals of the last finished frame
+    std::vector<PassStats> lastPasses;  // and of its passes
+    std::vector<PassStats> passes;      // passes of the running frame
+    RenderCounters passStart;
+
+    // One row per pass and one "frame" row per frame while recording
+    std::string csvPath;
+    std::ofstream csv;
+};
+
+// Closes the previous frame (and writes its CSV rows); call once at the start of every frame.
+void BeginRenderStatsFrame(RenderStats& stats);
+
+void BeginRenderStatsPass(RenderStats& stats, const std::string& name);
+void EndRenderStatsPass(RenderStats& stats);
+
+bool StartRenderStatsCsv(RenderStats& stats, const std::string& path);
+void StopRenderStatsCsv(RenderStats& stats);
+
+void DrawRenderStatsWindow(RenderStats& stats);
+
+// Distribution of frame times in milliseconds, e.g. over a headless run
+struct FrameTimeSummary {
+    int frames = 0;
+    double average = 0;
+    double minimum = 0;
+    double maximum = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+};
+
+FrameTimeSummary SummarizeFrameTimes(std::vector<double> frameTimes);
+void PrintFrameTimeSummary(std::ostream& out, const FrameTimeSummary& summary);
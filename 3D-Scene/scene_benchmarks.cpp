@@ -0,0 +1,282 @@
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "app_context.h"
+#include "benchmark.h"
+#include "model.h"
+#include "render_graph.h"
+#include "terrain_generator.h"
+#include "terrain_raycast.h"
+
+#include "3rd-party/stb_image.h"
+
+// Micro benchmarks of the loaders and per-frame CPU work, and a macro benchmark
+// of whole headless frames of opengl-imgui-sample. Run from the build directory
+// like the sample, so ../assets resolves:
+//   scene-benchmarks [--filter TEXT] [--warmup N] [--repetitions N] [--json FILE]
+//                    [--baseline FILE] [--tolerance 0.1] [--frames N] [--sample PATH]
+// With a baseline the exit code is the number of benchmarks whose median grew by
+// more than the tolerance.
+
+namespace {
+    // Results of benchmarked pure functions go here so they aren't optimized away
+    volatile float sink;
+
+    // Mesh keeps only the VAO; its vertex and index buffers are read back from it
+    void DeleteMeshObjects(Mesh& mesh) {
+        GLint vertexBuffer = 0;
+        GLint indexBuffer = 0;
+        glBindVertexArray(mesh.MeshVAO);
+        glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vertexBuffer);
+        glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indexBuffer);
+        glBindVertexArray(0);
+        GLuint buffers[] = {(GLuint) vertexBuffer, (GLuint) indexBuffer};
+        glDeleteBuffers(2, buffers);
+        glDeleteVertexArrays(1, &mesh.MeshVAO);
+        for (Texture& texture : mesh.textures) {
+            glDeleteTextures(1, &texture.id);
+        }
+    }
+
+    // Whole frames: runs the sample headless and takes its average frame time
+    double RunHeadlessFrames(const std::string& sample, int frames) {
+        std::string command = fmt::format("{} --headless {}", sample, frames);
+        FILE* pipe = popen(command.c_str(), "r");
+        if (pipe == nullptr) {
+            std::cerr << "Can't run " << command << "\n";
+            exit(1);
+        }
+        char line[512];
+        double average = -1;
+        while (fgets(line, sizeof(line), pipe) != nullptr) {
+            int count;
+            if (sscanf(line, "%d frames, ms: avg %lf", &count, &average) == 2) {
+                break;
+            }
+        }
+        while (fgets(line, sizeof(line), pipe) != nullptr) {
+        }
+        if (pclose(pipe) != 0 || average < 0) {
+            std::cerr << command << " failed\n";
+            exit(1);
+        }
+        return average;
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string filter;
+    int warmup = -1;        // negative keeps each benchmark's own counts
+    int repetitions = -1;
+    std::string jsonPath;
+    std::string baselinePath;
+    double tolerance = 0.1;
+    int frames = 300;
+    std::string sample = "./opengl-imgui-sample";
+    for (int i = 1; i < argc; i += 2) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << arg << " needs a value\n";
+            return 1;
+        }
+        if (arg == "--filter") {
+            filter = argv[i + 1];
+        } else if (arg == "--warmup") {
+            warmup = std::atoi(argv[i + 1]);
+        } else if (arg == "--repetitions") {
+            repetitions = std::atoi(argv[i + 1]);
+        } else if (arg == "--json") {
+            jsonPath = argv[i + 1];
+        } else if (arg == "--baseline") {
+            baselinePath = argv[i + 1];
+        } else if (arg == "--tolerance") {
+            tolerance = std::atof(argv[i + 1]);
+        } else if (arg == "--frames") {
+            frames = std::atoi(argv[i + 1]);
+        } else if (arg == "--sample") {
+            sample = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    // The loaders upload to GL, so the micro benchmarks need a context too
+    AppContextSettings settings;
+    settings.headless = true;
+    settings.width = 64;
+    settings.height = 64;
+    AppContext app;
+    if (!CreateAppContext(app, settings)) {
+        return 1;
+    }
+
+    std::vector<Benchmark> benchmarks;
+
+    benchmarks.push_back({"obj/lighthouse", [] {
+        Model model;
+        double ms = MeasureMs([&] { LoadModel(model, "../assets/lighthouse/lighthouse.obj", "../assets/lighthouse/", 4); });
+        for (Mesh& mesh : model.meshes) {
+            DeleteMeshObjects(mesh);
+        }
+        return ms;
+    }});
+    benchmarks.push_back({"obj/boat", [] {
+        Model model;
+        double ms = MeasureMs([&] { LoadModel(model, "../assets/boat/gondol.obj", "../assets/boat/", 10); });
+        for (Mesh& mesh : model.meshes) {
+            DeleteMeshObjects(mesh);
+        }
+        return ms;
+    }});
+
+    benchmarks.push_back({"texture/decode jpg", [] {
+        return MeasureMs([] {
+            int width, height, channels;
+            unsigned char* data = stbi_load("../assets/sand_texture.jpg", &width, &height, &channels, 0);
+            stbi_image_free(data);
+        });
+    }});
+    benchmarks.push_back({"texture/decode png", [] {
+        return MeasureMs([] {
+            int width, height, channels;
+            unsigned char* data = stbi_load("../assets/grass_texture.png", &width, &height, &channels, 0);
+            stbi_image_free(data);
+        });
+    }});
+
+    TerrainGeneratorSettings terrainSettings;
+    terrainSettings.width = 512;
+    terrainSettings.height = 512;
+    std::vector<float> heights;
+    benchmarks.push_back({"terrain/generate 512", [&] {
+        return MeasureMs([&] { GenerateHeightMap(heights, terrainSettings); });
+    }, 1, 5});
+    GenerateHeightMap(heights, terrainSettings);
+    benchmarks.push_back({"terrain/landscape 512", [&] {
+        Landscape landscape;
+        double ms = MeasureMs([&] {
+            CreateLandscape(landscape, heights, 512, 512,
+                            "../assets/sand_texture.jpg", "../assets/grass_texture.png", "../assets/rock_texture.jpg",
+                            1.5, 50, 0.2, 0.5, 20);
+        });
+        DeleteMeshObjects(landscape.mesh);
+        DeleteMeshObjects(landscape.reducedMesh);
+        return ms;
+    }, 1, 5});
+
+    // Per-frame math, a thousand calls per repetition
+    glm::mat4 lightView = glm::lookAt(glm::vec3(-10, 5, 10), glm::vec3(0.0f), glm::vec3(0, 1, 0));
+    benchmarks.push_back({"cascades/CalculateCascades x1000", [&] {
+        std::vector<float> planes;
+        CalculateCascadeSplits(planes, 3, 0.1f, 60.0f, 0.75f);
+        std::vector<glm::mat4> projections(3);
+        std::vector<int> resolutions {1024, 1024, 512};
+        return MeasureMs([&] {
+            for (int i = 0; i < 1000; i++) {
+                glm::mat4 view = glm::lookAt(glm::vec3(-14, 1.4f, -11.5f),
+                                             glm::vec3(-14, 1.4f, -11.5f) + glm::vec3(glm::cos(i * 0.01f), 0.1f, glm::sin(i * 0.01f)),
+                                             glm::vec3(0, 1, 0));
+                CalculateCascades(projections, planes, view, lightView, 1280, 720, glm::radians(45.0f),
+                                  resolutions, glm::vec3(-20, -1, -20), glm::vec3(0, 5, 0));
+            }
+        });
+    }});
+    benchmarks.push_back({"cascades/CalculateOblique x1000", [] {
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+        return MeasureMs([&] {
+            for (int i = 0; i < 1000; i++) {
+                sink = CalculateOblique(projection, glm::vec4(0, 1, 0, -0.001f * i))[2][2];
+            }
+        });
+    }});
+
+    // Culling: the render graph's pass culling and the terrain visibility tests
+    RenderGraph graph;
+    benchmarks.push_back({"culling/render graph compile", [&] {
+        return MeasureMs([&] {
+            BeginRenderGraph(graph);
+            int shadows = ImportRenderTarget(graph, "shadow atlas", 1, 0, 2);
+            int reflection = ImportRenderTarget(graph, "reflection", 3, 4);
+            int scene = ImportRenderTarget(graph, "scene", 5, 6, 7);
+            RenderTargetDesc desc;
+            desc.width = 1280;
+            desc.height = 720;
+            desc.colorFormat = GL_RGB;
+            desc.depthFormat = GL_DEPTH_COMPONENT;
+            int refraction = CreateRenderTarget(graph, "refraction", desc);
+            AddRenderPass(graph, "shadows", {}, {shadows}, [] {});
+            AddRenderPass(graph, "reflection", {shadows}, {reflection}, [] {});
+            AddRenderPass(graph, "main", {shadows}, {scene}, [] {});
+            AddRenderPass(graph, "refraction copy", {scene}, {refraction}, [] {});
+            AddRenderPass(graph, "water", {reflection, shadows}, {scene}, [] {});
+            AddRenderPass(graph, "present", {scene}, {}, [] {}, true);
+            graph.compiledShape.clear();    // compile every time rather than reuse the plan
+            CompileRenderGraph(graph);
+        });
+    }});
+
+    std::vector<std::vector<float>> heightMap(512, std::vector<float>(512));
+    for (int row = 0; row < 512; row++) {
+        for (int col = 0; col < 512; col++) {
+            heightMap[row][col] = 1.5f * heights[row * 512 + col];
+        }
+    }
+    HeightPyramid pyramid;
+    BuildHeightPyramid(pyramid, heightMap, 20, -0.05f);
+    benchmarks.push_back({"culling/terrain line of sight x1000", [&] {
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> coordinate(-20.0f, 0.0f);
+        return MeasureMs([&] {
+            for (int i = 0; i < 1000; i++) {
+                glm::vec3 from(coordinate(random), 2.0f, coordinate(random));
+                glm::vec3 to(coordinate(random), 0.5f, coordinate(random));
+                sink = TerrainLineOfSight(pyramid, from, to);
+            }
+        });
+    }});
+
+    benchmarks.push_back({fmt::format("frame/headless x{}", frames), [&] {
+        return RunHeadlessFrames(sample, frames);
+    }, 0, 3});
+
+    std::vector<BenchmarkResult> results;
+    for (Benchmark& benchmark : benchmarks) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        if (warmup >= 0) {
+            benchmark.warmup = warmup;
+        }
+        if (repetitions > 0) {
+            benchmark.repetitions = repetitions;
+        }
+        BenchmarkResult result = RunBenchmark(benchmark);
+        std::cout << fmt::format("{:<36} median {:10.3f} ms  mean {:10.3f} ms  sd {:8.3f}  min {:10.3f}  p95 {:10.3f}\n",
+                                 result.name, result.median, result.mean, result.stddev, result.minimum, result.p95);
+        results.push_back(result);
+    }
+
+    DeleteRenderGraph(graph);
+    DestroyAppContext(app);
+
+    if (!jsonPath.empty() && !WriteBenchmarkJson(jsonPath, results)) {
+        return 1;
+    }
+    if (!baselinePath.empty()) {
+        std::map<std::string, double> baseline;
+        if (!LoadBenchmarkBaseline(baselinePath, baseline)) {
+            return 1;
+        }
+        return CompareWithBaseline(results, baseline, tolerance);
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <fmt/format.h>
+
+#include <glm/glm.hpp>
+
+#include "camera_path.h"
+#include "image_compare.h"
+
+// Golden image checks: renders fixed camera poses with opengl-imgui-sample
+// headless, once per performance mode, and compares every frame against the
+// stored reference of its pose. Run from the build directory like the sample:
+//   scene-golden [--references DIR] [--output DIR] [--mode TEXT] [--sample PATH]
+//                [--width W] [--height H] [--hold STEPS] [--update]
+// --update renders the reference mode and stores its frames as the references.
+// The output directory gets every frame and an amplified diff image per mode;
+// the exit code is the number of frames below their mode's thresholds.
+
+namespace {
+    struct GoldenPose {
+        std::string name;
+        glm::vec3 position;
+        glm::vec3 direction;
+    };
+
+    // Settings passed to the sample with --set, and how far its frames may drift
+    // from the references. Every optimization is compared against the reference
+    // mode, which turns them all off.
+    struct GoldenMode {
+        std::string name;
+        std::vector<std::string> settings;
+        double minPsnr;
+        double minSsim;
+    };
+
+    const std::vector<std::string> kReferenceSettings {
+            "horizon-map=0", "clipmap-reflection=0", "clipmap-main=0",
+            "reflection-scale=1", "reflection-interval=1", "reflection-reduced=0",
+            "shadow-cache=0", "stagger-cascades=0", "dynamic-resolution=0", "resolution-scale=1",
+            "occlusion=0"
+    };
+
+    std::vector<std::string> WithReference(const std::vector<std::string>& settings) {
+        std::vector<std::string> all = kReferenceSettings;
+        all.insert(all.end(), settings.begin(), settings.end());
+        return all;
+    }
+
+    bool MakeDirectory(const std::string& path) {
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+            return true;
+        }
+        if (mkdir(path.c_str(), 0755) != 0) {
+            std::cerr << "Can't create directory " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Every pose is held for hold steps so the caches and the staggered updates
+    // settle; the last frame of each is dumped
+    bool RenderPoses(const std::string& sample, const std::string& pathFile, const GoldenMode& mode,
+                     int width, int height, int hold, const std::string& directory) {
+        std::string command = fmt::format("{} --headless 0 --play-path {} --width {} --height {} "
+                                          "--dump-frames {} --dump-interval {} --dump-offset {}",
+                                          sample, pathFile, width, height, directory, hold, hold - 1);
+        for (const std::string& setting : mode.settings) {
+            command += " --set " + setting;
+        }
+        command += fmt::format(" > {}/log.txt 2>&1", directory);
+        if (std::system(command.c_str()) != 0) {
+            std::cerr << "Rendering " << mode.name << " failed, see " << directory << "/log.txt\n";
+            return false;
+        }
+        return true;
+    }
+
+    std::string DumpedFrame(const std::string& directory, int pose, int hold) {
+        return fmt::format("{}/frame_{:05d}.ppm", directory, pose * hold + hold - 1);
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string referenceDirectory = "../golden";
+    std::string outputDirectory = "golden_output";
+    std::string filter;
+    std::string sample = "./opengl-imgui-sample";
+    int width = 640;
+    int height = 360;
+    int hold = 8;
+    bool update = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--update") {
+            update = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << arg << " needs a value\n";
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--references") {
+            referenceDirectory = value;
+        } else if (arg == "--output") {
+            outputDirectory = value;
+        } else if (arg == "--mode") {
+            filter = value;
+        } else if (arg == "--sample") {
+            sample = value;
+        } else if (arg == "--width") {
+            width = std::atoi(value.c_str());
+        } else if (arg == "--height") {
+            height = std::atoi(value.c_str());
+        } else if (arg == "--hold") {
+            hold = std::max(1, std::atoi(value.c_str()));
+        } else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<GoldenPose> poses {
+            {"start", {-14, 1.425f, -11.53f}, {-0.516f, 0.1f, 1.17f}},
+            {"lighthouse", {-10, 2.0f, -12}, {-4, -0.5f, 5}},
+            {"water", {-4, 1.0f, -4}, {-1, -0.25f, -1}},
+            {"overview", {-2, 6.0f, -2}, {-1, -0.5f, -1}},
+            {"shore", {-18, 0.6f, -18}, {1, 0.05f, 0.6f}},
+    };
+
+    // Thresholds: the reference mode should reproduce its own references up to
+    // driver noise; the rest trade some accuracy for speed
+    std::vector<GoldenMode> modes {
+            {"reference", kReferenceSettings, 45, 0.995},
+            {"default", {}, 28, 0.93},
+            {"horizon-map", WithReference({"horizon-map=1"}), 30, 0.95},
+            {"clipmap", WithReference({"clipmap-reflection=1", "clipmap-main=1"}), 32, 0.96},
+            {"reduced-reflection", WithReference({"reflection-scale=0.5", "reflection-interval=2", "reflection-reduced=1"}), 28, 0.93},
+            {"shadow-cache", WithReference({"shadow-cache=1"}), 45, 0.995},
+            {"stagger-cascades", WithReference({"stagger-cascades=1"}), 35, 0.97},
+            {"occlusion", WithReference({"occlusion=1"}), 45, 0.995},
+            {"resolution-75", WithReference({"resolution-scale=0.75"}), 26, 0.9},
+    };
+
+    if (!MakeDirectory(outputDirectory) || (update && !MakeDirectory(referenceDirectory))) {
+        return 1;
+    }
+    CameraPath path;
+    for (const GoldenPose& pose : poses) {
+        for (int i = 0; i < hold; i++) {
+            path.samples.push_back({pose.position, glm::normalize(pose.direction)});
+        }
+    }
+    std::string pathFile = outputDirectory + "/poses.cpth";
+    if (!SaveCameraPath(path, pathFile)) {
+        return 1;
+    }
+
+    if (update) {
+        std::string directory = outputDirectory + "/reference";
+        if (!MakeDirectory(directory) || !RenderPoses(sample, pathFile, modes[0], width, height, hold, directory)) {
+            return 1;
+        }
+        for (size_t i = 0; i < poses.size(); i++) {
+            Image image;
+            std::string reference = fmt::format("{}/{}.ppm", referenceDirectory, poses[i].name);
+            if (!LoadPpm(image, DumpedFrame(directory, (int) i, hold)) || !SavePpm(image, reference)) {
+                return 1;
+            }
+            std::cout << "Updated " << reference << "\n";
+        }
+        return 0;
+    }
+
+    std::vector<Image> references(poses.size());
+    for (size_t i = 0; i < poses.size(); i++) {
+        if (!LoadPpm(references[i], fmt::format("{}/{}.ppm", referenceDirectory, poses[i].name))) {
+            std::cerr << "Render the references with --update first\n";
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    for (const GoldenMode& mode : modes) {
+        if (!filter.empty() && mode.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        std::string directory = outputDirectory + "/" + mode.name;
+        if (!MakeDirectory(directory) || !RenderPoses(sample, pathFile, mode, width, height, hold, directory)) {
+            failures += (int) poses.size();
+            continue;
+        }
+        std::cout << fmt::format("{} (PSNR >= {} dB, SSIM >= {})\n", mode.name, mode.minPsnr, mode.minSsim);
+        for (size_t i = 0; i < poses.size(); i++) {
+            Image image, diff;
+            ImageComparison comparison;
+            if (!LoadPpm(image, DumpedFrame(directory, (int) i, hold))
+                || !CompareImages(references[i], image, comparison, diff)) {
+                failures++;
+                continue;
+            }
+            SavePpm(diff, fmt::format("{}/diff_{}.ppm", directory, poses[i].name));
+            bool passed = comparison.psnr >= mode.minPsnr && comparison.ssim >= mode.minSsim;
+            failures += !passed;
+            std::cout << fmt::format("  {:<12} PSNR {:6.2f} dB  SSIM {:.4f}  max diff {:3d}  {:5.2f}% pixels off{}\n",
+                                     poses[i].name, comparison.psnr, comparison.ssim, comparison.maxDifference,
+                                     100.0 * comparison.differentPixels, passed ? "" : "  FAILED");
+        }
+    }
+    return failures;
+}
@@ -0,0 +1,584 @@
+#include "shadows.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "model.h"
+#include "render_stats.h"
+
+namespace {
+    unsigned int CreateAtlasFrameBuffer(unsigned int& texture, int size) {
+        unsigned int frameBuffer = CreateFrameBuffer();
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // Linear filtering with comparison makes every sampler2DShadow fetch a bilinear PCF
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Shadow atlas framebuffer is incomplete" << std::endl;
+            exit(1);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return frameBuffer;
+    }
+
+    unsigned int CreateMomentsFrameBuffer(unsigned int& texture, int size, int maxLevel) {
+        unsigned int frameBuffer = CreateFrameBuffer();
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size, size, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, maxLevel > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, maxLevel > 0 ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        if (maxLevel > 0) {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Shadow moments framebuffer is incomplete" << std::endl;
+            exit(1);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return frameBuffer;
+    }
+
+    void ClearRegion(const ShadowAtlasRegion& region) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(region.offset.x, region.offset.y, region.size, region.size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    void UploadShadowViews(const ShadowMap& shadowMap) {
+        // std140: mat4 matrices[kMaxShadowViews], then vec4 rects[kMaxShadowViews]
+        float data[kMaxShadowViews * 20] = {};
+        for (size_t i = 0; i < shadowMap.views.size(); i++) {
+            const ShadowView& view = shadowMap.views[i];
+            std::copy(glm::value_ptr(view.matrix), glm::value_ptr(view.matrix) + 16, data + 16 * i);
+            float* rect = data + 16 * kMaxShadowViews + 4 * i;
+            rect[0] = (float) view.region.size / shadowMap.atlasSize;
+            rect[1] = (float) view.region.size / shadowMap.atlasSize;
+            rect[2] = (float) view.region.offset.x / shadowMap.atlasSize;
+            rect[3] = (float) view.region.offset.y / shadowMap.atlasSize;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, shadowMap.viewBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), data);
+        CountUpload(sizeof(data));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void SetClipDistances(bool enabled) {
+        for (int i = 0; i < 4; i++) {
+            if (enabled) {
+                glEnable(GL_CLIP_DISTANCE0 + i);
+            } else {
+                glDisable(GL_CLIP_DISTANCE0 + i);
+            }
+        }
+    }
+
+    bool SameMatrix(const glm::mat4& a, const glm::mat4& b) {
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                if (std::fabs(a[c][r] - b[c][r]) > 1e-6f) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Whether an orthographic cascade projection still covers the current one to
+    // within a texel, so the static depth rendered with it can be reused.
+    bool CoversWithinTexel(const glm::mat4& cached, const glm::mat4& current, int resolution) {
+        for (int axis = 0; axis < 3; axis++) {
+            float texel = 2.0f / (cached[axis][axis] * resolution);
+            float cachedLow = (-1.0f - cached[3][axis]) / cached[axis][axis];
+            float cachedHigh = (1.0f - cached[3][axis]) / cached[axis][axis];
+            float currentLow = (-1.0f - current[3][axis]) / current[axis][axis];
+            float currentHigh = (1.0f - current[3][axis]) / current[axis][axis];
+            if (std::fabs(cachedLow - currentLow) > std::fabs(texel)
+                || std::fabs(cachedHigh - currentHigh) > std::fabs(texel)) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+void InitShadowAtlasAllocator(ShadowAtlasAllocator& allocator, int size) {
+    allocator.size = size;
+    allocator.freeBlocks.clear();
+    ShadowAtlasRegion whole;
+    whole.offset = glm::ivec2(0, 0);
+    whole.size = size;
+    allocator.freeBlocks.push_back(whole);
+}
+
+bool AllocateShadowRegion(ShadowAtlasAllocator& allocator, int size, ShadowAtlasRegion& region) {
+    // Smallest free block that fits, so large blocks stay whole for large requests
+    int best = -1;
+    for (int i = 0; i < (int) allocator.freeBlocks.size(); i++) {
+        int blockSize = allocator.freeBlocks[i].size;
+        if (blockSize >= size && (best < 0 || blockSize < allocator.freeBlocks[best].size)) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        return false;
+    }
+
+    ShadowAtlasRegion block = allocator.freeBlocks[best];
+    allocator.freeBlocks.erase(allocator.freeBlocks.begin() + best);
+    while (block.size / 2 >= size) {
+        int half = block.size / 2;
+        for (int q = 1; q < 4; q++) {
+            ShadowAtlasRegion quarter;
+            quarter.offset = glm::ivec2(block.offset.x + (q & 1 ? half : 0), block.offset.y + (q & 2 ? half : 0));
+            quarter.size = half;
+            allocator.freeBlocks.push_back(quarter);
+        }
+        block.size = half;
+    }
+    region = block;
+    return true;
+}
+
+void CreateShadowMap(ShadowMap& shadowMap, int atlasSize, int cascades, const std::vector<int>& viewSizes) {
+    if (viewSizes.size() > kMaxShadowViews) {
+        std::cerr << "At most " << kMaxShadowViews << " shadow views are supported" << std::endl;
+        exit(1);
+    }
+
+    shadowMap.atlasSize = atlasSize;
+    shadowMap.cascades = cascades;
+    InitShadowAtlasAllocator(shadowMap.allocator, atlasSize);
+
+    // Largest first so the buddy split leaves no holes
+    std::vector<int> order(viewSizes.size());
+    for (int i = 0; i < (int) order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return viewSizes[a] > viewSizes[b]; });
+
+    shadowMap.views.assign(viewSizes.size(), ShadowView());
+    for (int i : order) {
+        if (!AllocateShadowRegion(shadowMap.allocator, viewSizes[i], shadowMap.views[i].region)) {
+            std::cerr << "Shadow view " << i << " (" << viewSizes[i] << ") does not fit into a "
+                      << atlasSize << " shadow atlas" << std::endl;
+            exit(1);
+        }
+        shadowMap.blurSize = std::max(shadowMap.blurSize, viewSizes[i]);
+    }
+
+    shadowMap.frameBuffer = CreateAtlasFrameBuffer(shadowMap.depthTexture, atlasSize);
+    shadowMap.staticFrameBuffer = CreateAtlasFrameBuffer(shadowMap.staticDepthTexture, atlasSize);
+
+    glGenBuffers(1, &shadowMap.viewBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, shadowMap.viewBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, kMaxShadowViews * 20 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, kShadowViewsBinding, shadowMap.viewBuffer);
+    UploadShadowViews(shadowMap);
+
+    shadowMap.cachedProjections.assign(viewSizes.size(), glm::mat4(1.0f));
+    InvalidateShadowCache(shadowMap);
+
+    shadowMap.momentsFrameBuffer = CreateMomentsFrameBuffer(shadowMap.momentsTexture, atlasSize, 3);
+    shadowMap.blurFrameBuffer = CreateMomentsFrameBuffer(shadowMap.blurTexture, shadowMap.blurSize, 0);
+
+    glGenSamplers(1, &shadowMap.depthSampler);
+    glSamplerParameteri(shadowMap.depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glSamplerParameteri(shadowMap.depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(shadowMap.depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenVertexArrays(1, &shadowMap.vao);
+    shadowMap.momentsCurrent = false;
+}
+
+void DeleteShadowMap(ShadowMap& shadowMap) {
+    glDeleteFramebuffers(1, &shadowMap.frameBuffer);
+    glDeleteFramebuffers(1, &shadowMap.staticFrameBuffer);
+    glDeleteFramebuffers(1, &shadowMap.momentsFrameBuffer);
+    glDeleteFramebuffers(1, &shadowMap.blurFrameBuffer);
+    glDeleteTextures(1, &shadowMap.depthTexture);
+    glDeleteTextures(1, &shadowMap.staticDepthTexture);
+    glDeleteTextures(1, &shadowMap.momentsTexture);
+    glDeleteTextures(1, &shadowMap.blurTexture);
+    glDeleteBuffers(1, &shadowMap.viewBuffer);
+    glDeleteSamplers(1, &shadowMap.depthSampler);
+    glDeleteVertexArrays(1, &shadowMap.vao);
+}
+
+size_t ShadowMapMemory(const ShadowMap& shadowMap) {
+    size_t atlasTexels = (size_t) shadowMap.atlasSize * shadowMap.atlasSize;
+    size_t depth = 2 * atlasTexels * 4;
+    size_t moments = 0;
+    for (int level = 0; level <= 3; level++) {
+        moments += (atlasTexels >> (2 * level)) * 8;
+    }
+    size_t blur = (size_t) shadowMap.blurSize * shadowMap.blurSize * 8;
+    return depth + moments + blur;
+}
+
+void InvalidateShadowCache(ShadowMap& shadowMap) {
+    shadowMap.cacheValid.assign(shadowMap.views.size(), false);
+}
+
+void RenderShadowMap(ShadowMap& shadowMap, Scene& scene, glm::mat4 lightView,
+                     const std::vector<glm::mat4>& lightProjections,
+                     const std::vector<glm::mat4>& spotMatrices,
+                     int viewMask) {
+    glm::mat4 oldView = scene.View;
+    glm::mat4 oldProjection = scene.Projection;
+    scene.View = glm::mat4(1.0f);
+    scene.Projection = glm::mat4(1.0f);
+    glBindBufferBase(GL_UNIFORM_BUFFER, kShadowViewsBinding, shadowMap.viewBuffer);
+    glViewport(0, 0, shadowMap.atlasSize, shadowMap.atlasSize);
+    SetClipDistances(true);
+
+    int viewCount = (int) shadowMap.views.size();
+    shadowMap.viewsRenderedLastFrame = 0;
+
+    if (!shadowMap.useStaticCache) {
+        for (int i = 0; i < viewCount; i++) {
+            if (viewMask & (1 << i)) {
+                shadowMap.views[i].matrix = i < shadowMap.cascades ? lightProjections[i] * lightView
+                                                                   : spotMatrices[i - shadowMap.cascades];
+            }
+        }
+        UploadShadowViews(shadowMap);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.frameBuffer);
+        CountFrameBufferBind();
+        for (int i = 0; i < viewCount; i++) {
+            if (viewMask & (1 << i)) {
+                ClearRegion(shadowMap.views[i].region);
+                shadowMap.viewsRenderedLastFrame++;
+            }
+        }
+        scene.shadowViewMask = viewMask & ~shadowMap.dynamicOnlyMask;
+        scene.DrawStaticShadows(!scene.useHorizonMap);
+        scene.shadowViewMask = viewMask;
+        scene.DrawDynamicShadows();
+
+        InvalidateShadowCache(shadowMap);
+    } else {
+        if (!SameMatrix(lightView, shadowMap.cachedLightView)) {
+            for (int i = 0; i < shadowMap.cascades; i++) {
+                shadowMap.cacheValid[i] = false;
+            }
+            shadowMap.cachedLightView = lightView;
+        }
+
+        int staleMask = 0;
+        for (int i = 0; i < viewCount; i++) {
+            if (!(viewMask & (1 << i))) {
+                continue;
+            }
+            if (shadowMap.dynamicOnlyMask & (1 << i)) {
+                shadowMap.views[i].matrix = spotMatrices[i - shadowMap.cascades];
+                continue;
+            }
+            bool stale;
+            if (i < shadowMap.cascades) {
+                stale = !shadowMap.cacheValid[i]
+                        || !CoversWithinTexel(shadowMap.cachedProjections[i], lightProjections[i],
+                                              shadowMap.views[i].region.size);
+                if (stale) {
+                    shadowMap.cachedProjections[i] = lightProjections[i];
+                }
+                shadowMap.views[i].matrix = shadowMap.cachedProjections[i] * shadowMap.cachedLightView;
+            } else {
+                const glm::mat4& spotMatrix = spotMatrices[i - shadowMap.cascades];
+                stale = !shadowMap.cacheValid[i] || !SameMatrix(shadowMap.cachedProjections[i], spotMatrix);
+                shadowMap.cachedProjections[i] = spotMatrix;
+                shadowMap.views[i].matrix = spotMatrix;
+            }
+            if (stale) {
+                shadowMap.cacheValid[i] = true;
+                staleMask |= 1 << i;
+            }
+        }
+        UploadShadowViews(shadowMap);
+
+        if (staleMask != 0) {
+            glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.staticFrameBuffer);
+            CountFrameBufferBind();
+            for (int i = 0; i < viewCount; i++) {
+                if (staleMask & (1 << i)) {
+                    ClearRegion(shadowMap.views[i].region);
+                    shadowMap.viewsRenderedLastFrame++;
+                }
+            }
+            scene.shadowViewMask = staleMask;
+            scene.DrawStaticShadows(!scene.useHorizonMap);
+        }
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, shadowMap.staticFrameBuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMap.frameBuffer);
+        CountFrameBufferBind();
+        for (int i = 0; i < viewCount; i++) {
+            if (!(viewMask & (1 << i)) || (shadowMap.dynamicOnlyMask & (1 << i))) {
+                continue;
+            }
+            const ShadowAtlasRegion& region = shadowMap.views[i].region;
+            int x1 = region.offset.x + region.size;
+            int y1 = region.offset.y + region.size;
+            glBlitFramebuffer(region.offset.x, region.offset.y, x1, y1,
+                              region.offset.x, region.offset.y, x1, y1,
+                              GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.frameBuffer);
+        CountFrameBufferBind();
+        for (int i = 0; i < viewCount; i++) {
+            if ((viewMask & shadowMap.dynamicOnlyMask) & (1 << i)) {
+                ClearRegion(shadowMap.views[i].region);
+            }
+        }
+        scene.shadowViewMask = viewMask;
+        scene.DrawDynamicShadows();
+    }
+
+    SetClipDistances(false);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CountFrameBufferBind();
+    scene.View = oldView;
+    scene.Projection = oldProjection;
+}
+
+void UpdateShadowMoments(ShadowMap& shadowMap, shader_t& momentsShader, int viewMask) {
+    if (!shadowMap.useMoments) {
+        shadowMap.momentsCurrent = false;
+        return;
+    }
+    if (!shadowMap.momentsCurrent) {
+        viewMask = (1 << shadowMap.cascades) - 1;
+        shadowMap.momentsCurrent = true;
+    }
+    if (viewMask == 0) {
+        return;
+    }
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(shadowMap.vao);
+
+    momentsShader.use();
+    momentsShader.set_uniform("depthMap", 0);
+    momentsShader.set_uniform("moments", 1);
+    momentsShader.set_uniform("radius", shadowMap.blurRadius);
+    momentsShader.set_uniform("exponent", shadowMap.exponent);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, shadowMap.depthTexture);
+    glBindSampler(0, shadowMap.depthSampler);
+    glActiveTexture(GL_TEXTURE0 + 1);
+
+    for (int i = 0; i < (int) shadowMap.views.size(); i++) {
+        if (!(viewMask & (1 << i))) {
+            continue;
+        }
+        const ShadowAtlasRegion& region = shadowMap.views[i].region;
+        momentsShader.set_uniform("regionSize", region.size);
+
+        // Horizontal pass from the depth region into the scratch target, vertical
+        // pass from there into the moments region
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.blurFrameBuffer);
+        CountFrameBufferBind();
+        glViewport(0, 0, region.size, region.size);
+        momentsShader.set_uniform("fromDepth", true);
+        momentsShader.set_uniform("sourceOffset", (float) region.offset.x, (float) region.offset.y);
+        momentsShader.set_uniform("targetOffset", 0.0f, 0.0f);
+        CountDraw(1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindTexture(GL_TEXTURE_2D, shadowMap.blurTexture);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.momentsFrameBuffer);
+        CountFrameBufferBind();
+        glViewport(region.offset.x, region.offset.y, region.size, region.size);
+        momentsShader.set_uniform("fromDepth", false);
+        momentsShader.set_uniform("sourceOffset", 0.0f, 0.0f);
+        momentsShader.set_uniform("targetOffset", (float) region.offset.x, (float) region.offset.y);
+        CountDraw(1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindSampler(0, 0);
+    glBindTexture(GL_TEXTURE_2D, shadowMap.momentsTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CountFrameBufferBind();
+    glEnable(GL_DEPTH_TEST);
+}
+
+void CreateStaticShadowCube(StaticShadowCube& cube, int size) {
+    cube.size = size;
+    cube.valid = false;
+
+    cube.frameBuffer = CreateFrameBuffer();
+    glGenTextures(1, &cube.depthTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cube.depthTexture);
+    for (int face = 0; face < 6; face++) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT32F, size, size, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, cube.depthTexture, 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Static shadow cube framebuffer is incomplete" << std::endl;
+        exit(1);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Only view 0 is ever used; its region is the whole face
+    float data[kMaxShadowViews * 20] = {};
+    float* rect = data + 16 * kMaxShadowViews;
+    rect[0] = 1.0f;
+    rect[1] = 1.0f;
+    glGenBuffers(1, &cube.viewBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, cube.viewBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(data), data, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void DeleteStaticShadowCube(StaticShadowCube& cube) {
+    glDeleteFramebuffers(1, &cube.frameBuffer);
+    glDeleteTextures(1, &cube.depthTexture);
+    glDeleteBuffers(1, &cube.viewBuffer);
+    cube.valid = false;
+}
+
+void UpdateStaticShadowCube(StaticShadowCube& cube, Scene& scene, glm::vec3 position) {
+    if (cube.valid && glm::length(position - cube.position) < 1e-5f) {
+        return;
+    }
+
+    // GL cube map face orientations: +X, -X, +Y, -Y, +Z, -Z
+    const glm::vec3 directions[6] = {
+            glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0),
+            glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+    };
+    const glm::vec3 ups[6] = {
+            glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1),
+            glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0)
+    };
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, cube.nearPlane, cube.farPlane);
+
+    glm::mat4 oldView = scene.View;
+    glm::mat4 oldProjection = scene.Projection;
+    int oldMask = scene.shadowViewMask;
+    scene.View = glm::mat4(1.0f);
+    scene.Projection = glm::mat4(1.0f);
+    scene.shadowViewMask = 1;
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, kShadowViewsBinding, cube.viewBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, cube.frameBuffer);
+    CountFrameBufferBind();
+    glViewport(0, 0, cube.size, cube.size);
+    for (int face = 0; face < 6; face++) {
+        glm::mat4 matrix = projection * glm::lookAt(position, position + directions[face], ups[face]);
+        glBindBuffer(GL_UNIFORM_BUFFER, cube.viewBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(matrix), glm::value_ptr(matrix));
+        CountUpload(sizeof(matrix));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                               cube.depthTexture, 0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        // The beam reaches the terrain whatever the sun's self-shadowing mode
+        scene.DrawStaticShadows(true);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CountFrameBufferBind();
+
+    scene.View = oldView;
+    scene.Projection = oldProjection;
+    scene.shadowViewMask = oldMask;
+
+    cube.position = position;
+    cube.valid = true;
+}
+
+int ScheduleCascades(CascadeSchedule& schedule, int cascades) {
+    schedule.frame++;
+    schedule.lastUpdate.resize(cascades, -1);
+
+    int mask = 0;
+    if (!schedule.enabled) {
+        mask = (1 << cascades) - 1;
+    } else {
+        for (int picked = 0; picked < std::max(1, schedule.budget); picked++) {
+            int best = -1;
+            float bestPriority = 0.0f;
+            for (int i = 0; i < cascades; i++) {
+                if (mask & (1 << i)) {
+                    continue;
+                }
+                if (schedule.lastUpdate[i] < 0) {
+                    best = i;
+                    break;
+                }
+                int interval = i < (int) schedule.intervals.size() ? std::max(1, schedule.intervals[i]) : 1;
+                long long age = schedule.frame - schedule.lastUpdate[i];
+                float priority = (float) age / interval;
+                if (age >= interval && priority > bestPriority) {
+                    best = i;
+                    bestPriority = priority;
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            mask |= 1 << best;
+        }
+
+        // Layers never rendered hold no valid depth, so they go in regardless of the budget
+        for (int i = 0; i < cascades; i++) {
+            if (schedule.lastUpdate[i] < 0) {
+                mask |= 1 << i;
+            }
+        }
+    }
+
+    for (int i = 0; i < cascades; i++) {
+        if (mask & (1 << i)) {
+            schedule.lastUpdate[i] = schedule.frame;
+        }
+    }
+    schedule.lastMask = mask;
+    return mask;
+}
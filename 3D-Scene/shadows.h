@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "opengl_shader.h"
+
+class Scene;
+
+// Square power-of-two regions handed out from one shadow atlas, buddy style:
+// a free block is split into quarters until it matches the requested size.
+struct ShadowAtlasRegion {
+    glm::ivec2 offset;
+    int size = 0;
+};
+
+struct ShadowAtlasAllocator {
+    int size = 0;
+    std::vector<ShadowAtlasRegion> freeBlocks;
+};
+
+void InitShadowAtlasAllocator(ShadowAtlasAllocator& allocator, int size);
+bool AllocateShadowRegion(ShadowAtlasAllocator& allocator, int size, ShadowAtlasRegion& region);
+
+// One shadow view: a sun cascade or a spotlight.
+struct ShadowView {
+    ShadowAtlasRegion region;
+    glm::mat4 matrix = glm::mat4(0.0f);    // world to light clip space the region was last rendered with
+};
+
+// Must match the ShadowViews block in shadow_cascades.glsl and shadow_cascades.gs
+const int kMaxShadowViews = 4;
+const unsigned int kShadowViewsBinding = 0;
+
+// Every shadow view lives in one depth atlas. Views [0, cascades) are the sun
+// cascades, the rest are spotlights. All views are rendered in a single pass:
+// shadow_cascades.gs transforms every caster triangle by each view's matrix and
+// squeezes it into the view's atlas region, clipping at the region's edges. The
+// matrices and region scale/offsets are kept in a uniform block shared by the
+// geometry shader and the shading.
+//
+// Static casters are kept in a second atlas and only re-rendered for cascades
+// whose light-space bounds moved by more than a texel or when the sun moves.
+// Every frame the static regions are blitted into the atlas and the moving
+// casters are drawn on top.
+struct ShadowMap {
+    int atlasSize = 0;
+    int cascades = 0;
+    std::vector<ShadowView> views;
+    ShadowAtlasAllocator allocator;
+    unsigned int frameBuffer = 0;
+    unsigned int depthTexture = 0;      // GL_TEXTURE_2D atlas with depth comparison
+    unsigned int viewBuffer = 0;        // uniform buffer for the ShadowViews block
+
+    bool useStaticCache = true;
+    unsigned int staticFrameBuffer = 0;
+    unsigned int staticDepthTexture = 0;
+    std::vector<glm::mat4> cachedProjections;
+    std::vector<bool> cacheValid;
+    glm::mat4 cachedLightView;
+    int viewsRenderedLastFrame = 0;
+
+    // Exponential variance mode: every region is also converted to the moments
+    // (e^(c d), e^(2 c d)), blurred with a separable Gaussian and mipmapped, so
+    // shading filters with a single trilinear fetch whatever the kernel size.
+    // Mip levels stop at 1/8 so regions bleed into each other by a few texels at most.
+    bool useMoments = false;
+    int blurRadius = 3;
+    float exponent = 40.0f;     // e^(2c) has to stay well inside float range
+    unsigned int momentsFrameBuffer = 0;
+    unsigned int momentsTexture = 0;    // RG32F atlas with mipmaps
+    unsigned int blurFrameBuffer = 0;
+    unsigned int blurTexture = 0;       // sized for the largest region
+    int blurSize = 0;
+    unsigned int depthSampler = 0;      // reads the depth atlas without comparison
+    unsigned int vao = 0;
+    bool momentsCurrent = false;
+
+    // Views whose static casters come from somewhere else (the projector's
+    // StaticShadowCube); only the moving casters are drawn into them.
+    int dynamicOnlyMask = 0;
+};
+
+// viewSizes holds the region size of every view, cascades first.
+void CreateShadowMap(ShadowMap& shadowMap, int atlasSize, int cascades, const std::vector<int>& viewSizes);
+void DeleteShadowMap(ShadowMap& shadowMap);
+
+// GPU memory held by the atlases and the moment targets, in bytes
+size_t ShadowMapMemory(const ShadowMap& shadowMap);
+
+// Forces the static casters to be redrawn, e.g. after the set of casters changed
+void InvalidateShadowCache(ShadowMap& shadowMap);
+
+// Renders the scene's casters into the views in viewMask (bit i for view i).
+// lightProjections are the cascade projections for lightView; spotMatrices the
+// full world to clip matrices of the spotlights. Views that are skipped keep
+// their depth and matrix. Uploads the ShadowViews block and leaves the default
+// framebuffer bound.
+void RenderShadowMap(ShadowMap& shadowMap, Scene& scene, glm::mat4 lightView,
+                     const std::vector<glm::mat4>& lightProjections,
+                     const std::vector<glm::mat4>& spotMatrices,
+                     int viewMask);
+
+// Regenerates the moments of the views in viewMask (all cascades the first time
+// after the mode is switched on) from the depth atlas. Spotlights always use PCF.
+void UpdateShadowMoments(ShadowMap& shadowMap, shader_t& momentsShader, int viewMask);
+
+// Depth of the static casters in every direction around a fixed light, rendered
+// once into a cube map. A spotlight that only turns samples its cone from here
+// and needs nothing but the moving casters in its per-frame view.
+struct StaticShadowCube {
+    int size = 0;
+    float nearPlane = 0.25f;    // keeps the light's own housing out
+    float farPlane = 30.0f;
+    unsigned int frameBuffer = 0;
+    unsigned int depthTexture = 0;  // GL_TEXTURE_CUBE_MAP with depth comparison
+    unsigned int viewBuffer = 0;    // ShadowViews block holding the face being drawn
+    glm::vec3 position;
+    bool valid = false;
+};
+
+void CreateStaticShadowCube(StaticShadowCube& cube, int size);
+void DeleteStaticShadowCube(StaticShadowCube& cube);
+
+// Renders the static casters around position unless the cube already holds
+// them. Rebinds the ShadowViews binding point, so call before RenderShadowMap.
+void UpdateStaticShadowCube(StaticShadowCube& cube, Scene& scene, glm::vec3 position);
+
+// Spreads cascade updates over frames: cascade i is refreshed every intervals[i]
+// frames and at most budget cascades are refreshed per frame, the most overdue
+// first. Cascades that are skipped keep their depth and their old light-space
+// matrix, so shading still projects into them correctly, only dynamic casters lag.
+struct CascadeSchedule {
+    bool enabled = true;
+    std::vector<int> intervals {1, 2, 4};
+    int budget = 2;
+
+    long long frame = 0;
+    std::vector<long long> lastUpdate;
+    int lastMask = 0;
+};
+
+// Advances the schedule by one frame and returns the cascades to refresh (bit i
+// set for cascade i). Cascades never rendered before are always refreshed.
+int ScheduleCascades(CascadeSchedule& schedule, int cascades);
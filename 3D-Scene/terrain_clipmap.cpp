@@ -0,0 +1,127 @@
+#include "terrain_clipmap.h"
+
+#include <cmath>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "render_stats.h"
+
+namespace {
+    int Wrap(int value, int count) {
+        return ((value % count) + count) % count;
+    }
+
+    // Maps the world xz square of one tile onto the whole clip space, looking down.
+    glm::mat4 TileViewProjection(float x0, float z0, float tileWorld) {
+        glm::mat4 m(0.0f);
+        m[0][0] = 2.0f / tileWorld;
+        m[3][0] = -2.0f * x0 / tileWorld - 1.0f;
+        m[2][1] = 2.0f / tileWorld;
+        m[3][1] = -2.0f * z0 / tileWorld - 1.0f;
+        m[3][3] = 1.0f;
+        return m;
+    }
+}
+
+void CreateAlbedoClipmap(AlbedoClipmap& clipmap, int resolution, int tiles, float extent) {
+    clipmap.resolution = resolution;
+    clipmap.tiles = tiles;
+    clipmap.extent = extent;
+    clipmap.valid = false;
+
+    clipmap.frameBuffer = CreateFrameBuffer();
+    glGenTextures(1, &clipmap.texture);
+    glBindTexture(GL_TEXTURE_2D, clipmap.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, resolution, resolution, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, clipmap.texture, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Albedo clipmap framebuffer is incomplete" << std::endl;
+        exit(1);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeleteAlbedoClipmap(AlbedoClipmap& clipmap) {
+    glDeleteFramebuffers(1, &clipmap.frameBuffer);
+    glDeleteTextures(1, &clipmap.texture);
+    clipmap.valid = false;
+}
+
+void UpdateAlbedoClipmap(AlbedoClipmap& clipmap, Landscape& landscape, shader_t& bakeShader, glm::vec3 cameraPos) {
+    float tileWorld = clipmap.extent / clipmap.tiles;
+    int tileResolution = clipmap.resolution / clipmap.tiles;
+    glm::ivec2 origin((int) std::floor(cameraPos.x / tileWorld) - clipmap.tiles / 2,
+                      (int) std::floor(cameraPos.z / tileWorld) - clipmap.tiles / 2);
+
+    clipmap.tilesBakedLastUpdate = 0;
+    if (clipmap.valid && origin.x == clipmap.origin.x && origin.y == clipmap.origin.y) {
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, clipmap.frameBuffer);
+    CountFrameBufferBind();
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_SCISSOR_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    glm::mat4 identity(1.0f);
+    bakeShader.use();
+    bakeShader.set_uniform("model", glm::value_ptr(identity));
+    bakeShader.set_uniform("projection", glm::value_ptr(identity));
+    bakeShader.set_uniform("waterNormal", 0.0f);
+
+    for (int tx = origin.x; tx < origin.x + clipmap.tiles; tx++) {
+        for (int tz = origin.y; tz < origin.y + clipmap.tiles; tz++) {
+            bool baked = clipmap.valid
+                         && tx >= clipmap.origin.x && tx < clipmap.origin.x + clipmap.tiles
+                         && tz >= clipmap.origin.y && tz < clipmap.origin.y + clipmap.tiles;
+            if (baked) {
+                continue;
+            }
+
+            int x = Wrap(tx, clipmap.tiles) * tileResolution;
+            int y = Wrap(tz, clipmap.tiles) * tileResolution;
+            glViewport(x, y, tileResolution, tileResolution);
+            glScissor(x, y, tileResolution, tileResolution);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            glm::mat4 viewProjection = TileViewProjection(tx * tileWorld, tz * tileWorld, tileWorld);
+            bakeShader.set_uniform("view", glm::value_ptr(viewProjection));
+            DrawLandscape(landscape, bakeShader);
+            clipmap.tilesBakedLastUpdate++;
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CountFrameBufferBind();
+
+    glBindTexture(GL_TEXTURE_2D, clipmap.texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    clipmap.origin = origin;
+    clipmap.valid = true;
+}
+
+glm::vec2 AlbedoClipmapMin(const AlbedoClipmap& clipmap) {
+    float tileWorld = clipmap.extent / clipmap.tiles;
+    float halfTexel = 0.5f * clipmap.extent / clipmap.resolution;
+    return glm::vec2(clipmap.origin.x * tileWorld + halfTexel, clipmap.origin.y * tileWorld + halfTexel);
+}
+
+glm::vec2 AlbedoClipmapMax(const AlbedoClipmap& clipmap) {
+    float tileWorld = clipmap.extent / clipmap.tiles;
+    float halfTexel = 0.5f * clipmap.extent / clipmap.resolution;
+    return glm::vec2((clipmap.origin.x + clipmap.tiles) * tileWorld - halfTexel,
+                     (clipmap.origin.y + clipmap.tiles) * tileWorld - halfTexel);
+}
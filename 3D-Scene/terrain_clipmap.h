@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model.h"
+
+// Blended terrain albedo around the camera, baked top-down into one texture.
+// The texture is addressed toroidally (uv = world xz / extent with GL_REPEAT),
+// so when the camera moves only the tiles that scroll into range are re-baked.
+struct AlbedoClipmap {
+    int resolution = 0;         // texels per side
+    int tiles = 0;              // tiles per side
+    float extent = 0;           // world units per side
+    unsigned int frameBuffer = 0;
+    unsigned int texture = 0;
+    glm::ivec2 origin;          // world tile (x, z) at the minimum corner
+    bool valid = false;
+    int tilesBakedLastUpdate = 0;
+};
+
+void CreateAlbedoClipmap(AlbedoClipmap& clipmap, int resolution, int tiles, float extent);
+void DeleteAlbedoClipmap(AlbedoClipmap& clipmap);
+
+// Re-bakes the tiles that entered the window centred on the camera. Binds its own
+// framebuffer and viewport; callers set theirs again afterwards.
+void UpdateAlbedoClipmap(AlbedoClipmap& clipmap, Landscape& landscape, shader_t& bakeShader, glm::vec3 cameraPos);
+
+// World xz rectangle with valid texels, shrunk by half a texel for filtering.
+glm::vec2 AlbedoClipmapMin(const AlbedoClipmap& clipmap);
+glm::vec2 AlbedoClipmapMax(const AlbedoClipmap& clipmap);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Procedural heightmap generator: fractal value noise with domain warping,
+// evaluated in parallel tiles. Output depends only on the settings and the
+// seed, never on the tile size or thread count.
+struct TerrainGeneratorSettings {
+    unsigned int seed = 1337;
+    int width = 1024;
+    int height = 1024;
+
+    int octaves = 6;
+    float frequency = 1.0f / 256.0f;   // in heightmap texels
+    float lacunarity = 2.0f;
+    float gain = 0.5f;
+
+    int warpOctaves = 3;
+    float warpFrequency = 1.0f / 512.0f;
+    float warpStrength = 96.0f;        // in heightmap texels
+
+    float seaLevel = 0.35f;            // heights below are flattened to zero
+    float islandFalloff = 1.0f;        // 0 disables the radial falloff to the map border
+
+    int tileSize = 128;
+    int threads = 0;                   // 0 uses std::thread::hardware_concurrency()
+};
+
+// Fills heights with width * height normalized samples in [0, 1], row-major.
+void GenerateHeightMap(std::vector<float>& heights, const TerrainGeneratorSettings& settings);
+
+// Writes heights as a binary 8-bit PGM, which LoadLandscape reads like the bundled jpg.
+bool SaveHeightMap(const std::string& path, const std::vector<float>& heights, int width, int height);
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "terrain_generator.h"
+#include "terrain_raycast.h"
+
+static void PrintUsage() {
+    std::cerr << "Usage: terrain-generator [options]\n"
+                 "  --width N            heightmap width (default 1024)\n"
+                 "  --height N           heightmap height (default 1024)\n"
+                 "  --seed N             noise seed (default 1337)\n"
+                 "  --octaves N          fbm octaves (default 6)\n"
+                 "  --frequency F        base frequency in 1/texels (default 1/256)\n"
+                 "  --warp F             domain warp strength in texels (default 96)\n"
+                 "  --sea-level F        normalized sea level (default 0.35)\n"
+                 "  --falloff F          island falloff, 0 disables (default 1)\n"
+                 "  --tile N             tile size (default 128)\n"
+                 "  --threads N          worker threads, 0 = all cores (default 0)\n"
+                 "  --repeat N           generate N times and report the best run\n"
+                 "  --output FILE.pgm    write the heightmap as 8-bit PGM\n"
+                 "  --raycast-bench N    cast N random rays against the result and report rays/s\n";
+}
+
+// Random rays from above the terrain towards random ground points, in the
+// same world placement the scene uses (scale 20, heights scaled by 1.5).
+static void RaycastBenchmark(const TerrainGeneratorSettings& settings, const std::vector<float>& heights, int rayCount) {
+    const float scale = 20.0f;
+    const float heightCoefficient = 1.5f;
+
+    std::vector<std::vector<float>> heightMap(settings.height, std::vector<float>(settings.width));
+    for (int i = 0; i < settings.height; i++) {
+        for (int j = 0; j < settings.width; j++) {
+            heightMap[i][j] = heights[(size_t) i * settings.width + j] * heightCoefficient;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    HeightPyramid pyramid;
+    BuildHeightPyramid(pyramid, heightMap, scale, 0.0f);
+    double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::mt19937 random(settings.seed);
+    std::uniform_real_distribution<float> ground(-scale, 0.0f);
+    std::uniform_real_distribution<float> altitude(0.5f, 4.0f);
+    std::vector<TerrainRay> rays(rayCount);
+    for (auto& ray : rays) {
+        ray.origin = glm::vec3(ground(random), altitude(random), ground(random));
+        glm::vec3 target(ground(random), 0.0f, ground(random));
+        ray.direction = target - ray.origin;
+        ray.maxDistance = 2.0f * scale;
+    }
+
+    std::vector<TerrainHit> hits;
+    start = std::chrono::steady_clock::now();
+    RaycastTerrainBatch(pyramid, rays, hits, 1);
+    double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    RaycastTerrainBatch(pyramid, rays, hits, settings.threads);
+    double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t hitCount = std::count_if(hits.begin(), hits.end(), [](const TerrainHit& hit) { return hit.hit; });
+    std::cout << fmt::format("pyramid: {} levels, built in {:.2f} ms\n", pyramid.levels.size(), buildSeconds * 1000.0);
+    std::cout << fmt::format("raycast: {} rays, {} hits, {:.2f} Mrays/s (1 thread), {:.2f} Mrays/s (batch)\n",
+                             rayCount, hitCount, rayCount / singleSeconds / 1e6, rayCount / batchSeconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+    TerrainGeneratorSettings settings;
+    std::string output;
+    int repeat = 1;
+    int raycastRays = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            PrintUsage();
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << "\n";
+            PrintUsage();
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--width") {
+            settings.width = std::atoi(value);
+        } else if (arg == "--height") {
+            settings.height = std::atoi(value);
+        } else if (arg == "--seed") {
+            settings.seed = (unsigned int) std::strtoul(value, nullptr, 10);
+        } else if (arg == "--octaves") {
+            settings.octaves = std::atoi(value);
+        } else if (arg == "--frequency") {
+            settings.frequency = (float) std::atof(value);
+        } else if (arg == "--warp") {
+            settings.warpStrength = (float) std::atof(value);
+        } else if (arg == "--sea-level") {
+            settings.seaLevel = (float) std::atof(value);
+        } else if (arg == "--falloff") {
+            settings.islandFalloff = (float) std::atof(value);
+        } else if (arg == "--tile") {
+            settings.tileSize = std::atoi(value);
+        } else if (arg == "--threads") {
+            settings.threads = std::atoi(value);
+        } else if (arg == "--repeat") {
+            repeat = std::max(1, std::atoi(value));
+        } else if (arg == "--raycast-bench") {
+            raycastRays = std::atoi(value);
+        } else if (arg == "--output") {
+            output = value;
+        } else {
+            std::cerr << "Unknown option " << arg << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (settings.width <= 0 || settings.height <= 0) {
+        std::cerr << "Heightmap size must be positive\n";
+        return 1;
+    }
+
+    std::vector<float> heights;
+    double best = 0.0;
+    for (int r = 0; r < repeat; r++) {
+        auto start = std::chrono::steady_clock::now();
+        GenerateHeightMap(heights, settings);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = r == 0 ? seconds : std::min(best, seconds);
+    }
+
+    double samples = (double) settings.width * settings.height;
+    std::cout << fmt::format("{}x{} seed {}: {:.2f} ms, {:.1f} Msamples/s\n",
+                             settings.width, settings.height, settings.seed,
+                             best * 1000.0, samples / best / 1e6);
+
+    if (!output.empty()) {
+        if (!SaveHeightMap(output, heights, settings.width, settings.height)) {
+            std::cerr << "Unable to write heightmap: " << output << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << output << std::endl;
+    }
+
+    if (raycastRays > 0) {
+        RaycastBenchmark(settings, heights, raycastRays);
+    }
+
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include "terrain_horizon.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <GL/glew.h>
+
+#include "render_stats.h"
+#include "trace.h"
+
+namespace {
+    // Horizon tangents are clamped from below so bilinear filtering next to
+    // unoccluded map borders stays well-behaved.
+    const float kMinTangent = -1.0f;
+
+    struct ProfilePoint {
+        float s;
+        float h;
+    };
+}
+
+void BakeHorizonMap(HorizonMap& map,
+                    const std::vector<std::vector<float>>& heightMap,
+                    float scale,
+                    glm::vec2 azimuth,
+                    int threads,
+                    const std::atomic<unsigned int> *cancel,
+                    unsigned int generation) {
+    int mapHeight = (int) heightMap.size();
+    int mapWidth = heightMap.empty() ? 0 : (int) heightMap[0].size();
+    map.width = mapWidth;
+    map.height = mapHeight;
+    map.azimuth = azimuth;
+    map.tangents.assign((size_t) mapWidth * mapHeight, kMinTangent);
+    if (mapWidth < 2 || mapHeight < 2) {
+        return;
+    }
+
+    // Heightmap rows follow world x and columns follow world z (see LoadLandscape).
+    glm::vec2 grid(azimuth.x * mapHeight / scale, azimuth.y * mapWidth / scale);
+    bool rowMajor = std::fabs(grid.x) >= std::fabs(grid.y);
+    int majorCount = rowMajor ? mapHeight : mapWidth;
+    int minorCount = rowMajor ? mapWidth : mapHeight;
+    float gridMajor = rowMajor ? grid.x : grid.y;
+    float gridMinor = rowMajor ? grid.y : grid.x;
+    if (gridMajor == 0.0f) {
+        return;
+    }
+
+    // Every line is minor = offset + major * slope with an integer offset, so at a
+    // given major index the lines round to distinct texels and never overlap.
+    float slope = gridMinor / gridMajor;
+    float majorSpacing = scale / majorCount;
+    float minorSpacing = scale / minorCount;
+    float stepLength = std::sqrt(majorSpacing * majorSpacing + slope * minorSpacing * slope * minorSpacing);
+
+    // Walk away from the sun so everything already visited lies towards it.
+    int start = gridMajor > 0.0f ? majorCount - 1 : 0;
+    int step = gridMajor > 0.0f ? -1 : 1;
+
+    float span = slope * (majorCount - 1);
+    int firstOffset = (int) std::floor(-std::max(0.0f, span)) - 1;
+    int lastOffset = (int) std::ceil(minorCount - 1 - std::min(0.0f, span)) + 1;
+    int lineCount = lastOffset - firstOffset + 1;
+
+    auto height = [&](int major, int minor) {
+        return rowMajor ? heightMap[major][minor] : heightMap[minor][major];
+    };
+
+    const int chunk = 32;
+    int chunkCount = (lineCount + chunk - 1) / chunk;
+    std::atomic<int> nextChunk(0);
+
+    auto worker = [&]() {
+        std::vector<ProfilePoint> hull;
+        hull.reserve(majorCount);
+
+        for (int c = nextChunk++; c < chunkCount; c = nextChunk++) {
+            if (cancel && cancel->load() != generation) {
+                return;
+            }
+
+            int chunkEnd = std::min(lineCount, (c + 1) * chunk);
+            for (int line = c * chunk; line < chunkEnd; line++) {
+                float offset = (float) (firstOffset + line);
+                hull.clear();
+
+                for (int k = 0; k < majorCount; k++) {
+                    int major = start + k * step;
+                    float minor = offset + major * slope;
+                    if (minor < 0.0f || minor > minorCount - 1) {
+                        continue;
+                    }
+
+                    int m0 = (int) minor;
+                    int m1 = std::min(m0 + 1, minorCount - 1);
+                    float f = minor - m0;
+                    ProfilePoint q = {k * stepLength, height(major, m0) * (1.0f - f) + height(major, m1) * f};
+
+                    auto elevation = [&q](const ProfilePoint& p) {
+                        return (p.h - q.h) / (q.s - p.s);
+                    };
+                    while (hull.size() >= 2 && elevation(hull[hull.size() - 2]) >= elevation(hull.back())) {
+                        hull.pop_back();
+                    }
+                    float tangent = hull.empty() ? kMinTangent : std::max(kMinTangent, elevation(hull.back()));
+                    hull.push_back(q);
+
+                    int texel = (int) std::lround(minor);
+                    if (rowMajor) {
+                        map.tangents[(size_t) major * mapWidth + texel] = tangent;
+                    } else {
+                        map.tangents[(size_t) texel * mapWidth + major] = tangent;
+                    }
+                }
+            }
+        }
+    };
+
+    int threadCount = threads > 0 ? threads : (int) std::thread::hardware_concurrency();
+    threadCount = std::max(1, std::min(threadCount, chunkCount));
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threadCount; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+HorizonBaker::HorizonBaker(const std::vector<std::vector<float>>& heightMap, float scale, int threads)
+        : heightMap_(heightMap), scale_(scale), threads_(threads), generation_(0) {
+    worker_ = std::thread(&HorizonBaker::Run, this);
+}
+
+HorizonBaker::~HorizonBaker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        generation_++;
+    }
+    wake_.notify_one();
+    worker_.join();
+}
+
+void HorizonBaker::MarkBaked(const HorizonMap& map) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requested_ = true;
+    lastAzimuth_ = map.azimuth;
+}
+
+void HorizonBaker::Update(glm::vec3 sunDirection) {
+    glm::vec2 horizontal(sunDirection.x, sunDirection.z);
+    if (glm::length(horizontal) < 1e-5f) {
+        return;
+    }
+    glm::vec2 azimuth = glm::normalize(horizontal);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (requested_ && glm::dot(azimuth, lastAzimuth_) >= std::cos(azimuthTolerance)) {
+            return;
+        }
+        requested_ = true;
+        lastAzimuth_ = azimuth;
+        requestedAzimuth_ = azimuth;
+        pending_ = true;
+        generation_++;
+    }
+    wake_.notify_one();
+}
+
+bool HorizonBaker::Poll(HorizonMap& map) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_) {
+        return false;
+    }
+    map = std::move(result_);
+    ready_ = false;
+    return true;
+}
+
+bool HorizonBaker::Busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return busy_ || pending_;
+}
+
+void HorizonBaker::Run() {
+    TRACE_THREAD("horizon baker");
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stop_ || pending_; });
+        if (stop_) {
+            return;
+        }
+
+        glm::vec2 azimuth = requestedAzimuth_;
+        unsigned int generation = generation_;
+        pending_ = false;
+        busy_ = true;
+        lock.unlock();
+
+        HorizonMap map;
+        {
+            TRACE_ZONE("BakeHorizonMap");
+            BakeHorizonMap(map, heightMap_, scale_, azimuth, threads_, &generation_, generation);
+        }
+
+        lock.lock();
+        busy_ = false;
+        if (generation_ == generation) {
+            result_ = std::move(map);
+            ready_ = true;
+        }
+    }
+}
+
+unsigned int CreateHorizonTexture(const HorizonMap& map) {
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, map.width, map.height, 0, GL_RED, GL_FLOAT, map.tangents.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return textureID;
+}
+
+void UpdateHorizonTexture(unsigned int texture, const HorizonMap& map) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, map.width, map.height, GL_RED, GL_FLOAT, map.tangents.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CountUpload((long long) map.tangents.size() * sizeof(float));
+}
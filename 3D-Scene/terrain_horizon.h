@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Terrain self-shadowing from a horizon map. For one sun azimuth every texel
+// stores the tangent of the highest terrain elevation seen towards the sun, so
+// the terrain is lit when the sun's elevation tangent is above it. The map only
+// depends on the azimuth: elevation changes need no rebake.
+struct HorizonMap {
+    int width = 0;
+    int height = 0;
+    glm::vec2 azimuth;           // normalized world (x, z) towards the sun
+    std::vector<float> tangents; // row-major, one per heightmap texel
+};
+
+// Bakes along lines parallel to the sun azimuth, keeping an upper convex hull of
+// the profile seen so far, so each line costs O(length). Lines are independent
+// and split across threads; threads <= 0 uses all hardware threads.
+void BakeHorizonMap(HorizonMap& map,
+                    const std::vector<std::vector<float>>& heightMap,
+                    float scale,
+                    glm::vec2 azimuth,
+                    int threads = 0,
+                    const std::atomic<unsigned int> *cancel = nullptr,
+                    unsigned int generation = 0);
+
+// Rebakes on a background thread whenever the sun azimuth moves by more than
+// azimuthTolerance radians. A newer request cancels the bake in progress.
+class HorizonBaker {
+public:
+    HorizonBaker(const std::vector<std::vector<float>>& heightMap, float scale, int threads = 0);
+    ~HorizonBaker();
+
+    // Takes a map baked elsewhere, e.g. synchronously at load, as the latest
+    // bake, so Update only rebakes once the sun moves away from its azimuth.
+    void MarkBaked(const HorizonMap& map);
+
+    // Call once per frame with the direction towards the sun.
+    void Update(glm::vec3 sunDirection);
+
+    // Moves the latest finished bake into map; false when nothing new is ready.
+    bool Poll(HorizonMap& map);
+
+    bool Busy() const;
+
+    float azimuthTolerance = glm::radians(0.5f);
+
+private:
+    void Run();
+
+    std::vector<std::vector<float>> heightMap_;
+    float scale_;
+    int threads_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread worker_;
+    bool stop_ = false;
+    bool pending_ = false;
+    bool ready_ = false;
+    bool busy_ = false;
+    bool requested_ = false;
+    glm::vec2 requestedAzimuth_;
+    glm::vec2 lastAzimuth_;
+    std::atomic<unsigned int> generation_;
+    HorizonMap result_;
+};
+
+unsigned int CreateHorizonTexture(const HorizonMap& map);
+void UpdateHorizonTexture(unsigned int texture, const HorizonMap& map);
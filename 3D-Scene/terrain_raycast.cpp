@@ -0,0 +1,312 @@
+#include "terrain_raycast.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace {
+    struct Node {
+        int level;
+        int row;
+        int col;
+    };
+
+    // Ray in heightmap grid space: x = row, y = height, z = col. The parameter t
+    // is shared with the normalized world-space ray, so it is a world distance.
+    struct GridRay {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        glm::vec3 inverse;
+    };
+
+    inline float SafeInverse(float d) {
+        const float eps = 1e-12f;
+        if (std::fabs(d) < eps) {
+            d = d < 0.0f ? -eps : eps;
+        }
+        return 1.0f / d;
+    }
+
+    inline float Height(const HeightPyramid& p, int row, int col) {
+        return p.heights[(size_t) row * p.mapWidth + col];
+    }
+
+    bool IntersectBox(const GridRay& ray, glm::vec3 boxMin, glm::vec3 boxMax, float& tNear, float& tFar) {
+        for (int a = 0; a < 3; a++) {
+            float t0 = (boxMin[a] - ray.origin[a]) * ray.inverse[a];
+            float t1 = (boxMax[a] - ray.origin[a]) * ray.inverse[a];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            tNear = std::max(tNear, t0);
+            tFar = std::min(tFar, t1);
+        }
+        return tNear <= tFar;
+    }
+
+    bool IntersectTriangle(const GridRay& ray, glm::vec3 a, glm::vec3 b, glm::vec3 c, float& t) {
+        glm::vec3 e1 = b - a;
+        glm::vec3 e2 = c - a;
+        glm::vec3 p = glm::cross(ray.direction, e2);
+        float det = glm::dot(e1, p);
+        if (std::fabs(det) < 1e-12f) {
+            return false;
+        }
+        float invDet = 1.0f / det;
+        glm::vec3 s = ray.origin - a;
+        float u = glm::dot(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f) {
+            return false;
+        }
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(ray.direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+        t = glm::dot(e2, q) * invDet;
+        return true;
+    }
+
+    // Like the landscape mesh, cell (row, col) is split along the
+    // (row, col)-(row + 1, col + 1) diagonal when row + col is even and along
+    // the (row + 1, col)-(row, col + 1) one when it is odd.
+    bool IntersectCell(const HeightPyramid& p, const GridRay& ray, int row, int col,
+                       float tMin, float tMax, float& t) {
+        glm::vec3 a((float) row, Height(p, row, col), (float) col);
+        glm::vec3 b((float) row + 1, Height(p, row + 1, col), (float) col);
+        glm::vec3 c((float) row + 1, Height(p, row + 1, col + 1), (float) col + 1);
+        glm::vec3 d((float) row, Height(p, row, col + 1), (float) col + 1);
+        bool odd = (row + col) & 1;
+
+        bool found = false;
+        float candidate;
+        if (IntersectTriangle(ray, a, b, odd ? d : c, candidate) && candidate >= tMin && candidate <= tMax) {
+            t = tMax = candidate;
+            found = true;
+        }
+        if (IntersectTriangle(ray, odd ? b : a, c, d, candidate) && candidate >= tMin && candidate <= tMax) {
+            t = candidate;
+            found = true;
+        }
+        return found;
+    }
+
+    bool Traverse(const HeightPyramid& p, glm::vec3 origin, glm::vec3 direction, float maxDistance,
+                  bool anyHit, TerrainHit& hit) {
+        hit.hit = false;
+        if (p.levels.empty() || glm::length(direction) == 0.0f) {
+            return false;
+        }
+
+        glm::vec3 worldDir = glm::normalize(direction);
+        float toRow = p.mapHeight / p.scale;
+        float toCol = p.mapWidth / p.scale;
+
+        GridRay ray;
+        ray.origin = glm::vec3((origin.x / p.scale + 1.0f) * p.mapHeight,
+                               origin.y - p.offsetY,
+                               (origin.z / p.scale + 1.0f) * p.mapWidth);
+        ray.direction = glm::vec3(worldDir.x * toRow, worldDir.y, worldDir.z * toCol);
+        ray.inverse = glm::vec3(SafeInverse(ray.direction.x), SafeInverse(ray.direction.y),
+                                SafeInverse(ray.direction.z));
+
+        int firstRow = ray.direction.x >= 0.0f ? 0 : 1;
+        int firstCol = ray.direction.z >= 0.0f ? 0 : 1;
+
+        float best = maxDistance;
+        Node stack[128];
+        int top = 0;
+        stack[top++] = {(int) p.levels.size() - 1, 0, 0};
+
+        while (top > 0) {
+            Node node = stack[--top];
+            int span = 1 << node.level;
+            int rows = p.levelSizes[0].x;
+            int cols = p.levelSizes[0].y;
+
+            glm::vec2 range = p.levels[node.level][(size_t) node.row * p.levelSizes[node.level].y + node.col];
+            glm::vec3 boxMin((float) (node.row * span), range.x, (float) (node.col * span));
+            glm::vec3 boxMax((float) std::min((node.row + 1) * span, rows),
+                             range.y,
+                             (float) std::min((node.col + 1) * span, cols));
+
+            float tNear = 0.0f;
+            float tFar = best;
+            if (!IntersectBox(ray, boxMin, boxMax, tNear, tFar)) {
+                continue;
+            }
+
+            if (node.level == 0) {
+                float t;
+                if (IntersectCell(p, ray, node.row, node.col, tNear - 1e-4f, tFar + 1e-4f, t) && t >= 0.0f && t <= best) {
+                    best = t;
+                    hit.hit = true;
+                    hit.cell = glm::ivec2(node.row, node.col);
+                    if (anyHit) {
+                        break;
+                    }
+                }
+                continue;
+            }
+
+            // Push the children far-to-near so the nearest one is visited first.
+            int childLevel = node.level - 1;
+            glm::ivec2 childSize = p.levelSizes[childLevel];
+            const int order[4][2] = {
+                    {1 - firstRow, 1 - firstCol},
+                    {1 - firstRow, firstCol},
+                    {firstRow, 1 - firstCol},
+                    {firstRow, firstCol}
+            };
+            for (int k = 0; k < 4; k++) {
+                int childRow = node.row * 2 + order[k][0];
+                int childCol = node.col * 2 + order[k][1];
+                if (childRow < childSize.x && childCol < childSize.y) {
+                    stack[top++] = {childLevel, childRow, childCol};
+                }
+            }
+        }
+
+        if (hit.hit) {
+            hit.distance = best;
+            hit.position = origin + worldDir * best;
+        }
+        return hit.hit;
+    }
+}
+
+void BuildHeightPyramid(HeightPyramid& pyramid,
+                        const std::vector<std::vector<float>>& heightMap,
+                        float scale,
+                        float offsetY) {
+    pyramid.mapHeight = (int) heightMap.size();
+    pyramid.mapWidth = heightMap.empty() ? 0 : (int) heightMap[0].size();
+    pyramid.scale = scale;
+    pyramid.offsetY = offsetY;
+    pyramid.levels.clear();
+    pyramid.levelSizes.clear();
+
+    pyramid.heights.resize((size_t) pyramid.mapWidth * pyramid.mapHeight);
+    for (int row = 0; row < pyramid.mapHeight; row++) {
+        std::copy(heightMap[row].begin(), heightMap[row].end(),
+                  pyramid.heights.begin() + (size_t) row * pyramid.mapWidth);
+    }
+
+    int rows = pyramid.mapHeight - 1;
+    int cols = pyramid.mapWidth - 1;
+    if (rows <= 0 || cols <= 0) {
+        return;
+    }
+
+    std::vector<glm::vec2> base((size_t) rows * cols);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            float h00 = Height(pyramid, row, col);
+            float h01 = Height(pyramid, row, col + 1);
+            float h10 = Height(pyramid, row + 1, col);
+            float h11 = Height(pyramid, row + 1, col + 1);
+            base[(size_t) row * cols + col] = glm::vec2(std::min(std::min(h00, h01), std::min(h10, h11)),
+                                                        std::max(std::max(h00, h01), std::max(h10, h11)));
+        }
+    }
+    pyramid.levels.push_back(base);
+    pyramid.levelSizes.push_back(glm::ivec2(rows, cols));
+
+    while (rows > 1 || cols > 1) {
+        int parentRows = (rows + 1) / 2;
+        int parentCols = (cols + 1) / 2;
+        const std::vector<glm::vec2>& child = pyramid.levels.back();
+        std::vector<glm::vec2> parent((size_t) parentRows * parentCols);
+
+        for (int row = 0; row < parentRows; row++) {
+            for (int col = 0; col < parentCols; col++) {
+                glm::vec2 range(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+                for (int r = row * 2; r < std::min(row * 2 + 2, rows); r++) {
+                    for (int c = col * 2; c < std::min(col * 2 + 2, cols); c++) {
+                        range.x = std::min(range.x, child[(size_t) r * cols + c].x);
+                        range.y = std::max(range.y, child[(size_t) r * cols + c].y);
+                    }
+                }
+                parent[(size_t) row * parentCols + col] = range;
+            }
+        }
+
+        pyramid.levels.push_back(parent);
+        pyramid.levelSizes.push_back(glm::ivec2(parentRows, parentCols));
+        rows = parentRows;
+        cols = parentCols;
+    }
+}
+
+bool RaycastTerrain(const HeightPyramid& pyramid, glm::vec3 origin, glm::vec3 direction,
+                    float maxDistance, TerrainHit& hit) {
+    return Traverse(pyramid, origin, direction, maxDistance, false, hit);
+}
+
+void RaycastTerrainBatch(const HeightPyramid& pyramid, const std::vector<TerrainRay>& rays,
+                         std::vector<TerrainHit>& hits, int threads) {
+    hits.resize(rays.size());
+
+    const int chunk = 256;
+    int chunkCount = (int) ((rays.size() + chunk - 1) / chunk);
+    int threadCount = threads > 0 ? threads : (int) std::thread::hardware_concurrency();
+    threadCount = std::max(1, std::min(threadCount, chunkCount));
+
+    std::atomic<int> nextChunk(0);
+    auto worker = [&]() {
+        for (int c = nextChunk++; c < chunkCount; c = nextChunk++) {
+            size_t end = std::min(rays.size(), (size_t) (c + 1) * chunk);
+            for (size_t i = (size_t) c * chunk; i < end; i++) {
+                Traverse(pyramid, rays[i].origin, rays[i].direction, rays[i].maxDistance, false, hits[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threadCount; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+bool TerrainLineOfSight(const HeightPyramid& pyramid, glm::vec3 from, glm::vec3 to) {
+    TerrainHit hit;
+    return !Traverse(pyramid, from, to - from, glm::length(to - from), true, hit);
+}
+
+float TerrainHeightAt(const HeightPyramid& pyramid, float x, float z) {
+    if (pyramid.levels.empty()) {
+        return pyramid.offsetY;
+    }
+
+    float u = (x / pyramid.scale + 1.0f) * pyramid.mapHeight;
+    float v = (z / pyramid.scale + 1.0f) * pyramid.mapWidth;
+    u = glm::clamp(u, 0.0f, (float) (pyramid.mapHeight - 1));
+    v = glm::clamp(v, 0.0f, (float) (pyramid.mapWidth - 1));
+
+    int row = std::min((int) u, pyramid.mapHeight - 2);
+    int col = std::min((int) v, pyramid.mapWidth - 2);
+    float fu = u - row;
+    float fv = v - col;
+
+    float h00 = Height(pyramid, row, col);
+    float h01 = Height(pyramid, row, col + 1);
+    float h10 = Height(pyramid, row + 1, col);
+    float h11 = Height(pyramid, row + 1, col + 1);
+
+    // Same diagonal as the landscape mesh, see IntersectCell
+    float h;
+    if ((row + col) & 1) {
+        h = fu + fv <= 1.0f ? h00 + fu * (h10 - h00) + fv * (h01 - h00)
+                            : h11 + (1.0f - fu) * (h01 - h11) + (1.0f - fv) * (h10 - h11);
+    } else {
+        h = fu >= fv ? h00 + fu * (h10 - h00) + fv * (h11 - h10)
+                     : h00 + fv * (h01 - h00) + fu * (h11 - h01);
+    }
+    return h + pyramid.offsetY;
+}
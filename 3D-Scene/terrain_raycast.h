@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Min/max mip pyramid over a landscape heightmap for hierarchical ray casting.
+// Cell (row, col) of level 0 spans heightmap texels [row, row + 1] x [col, col + 1];
+// every coarser level stores the min/max of the 2x2 cells below it.
+// World placement follows LoadLandscape: x = (row / mapHeight - 1) * scale,
+// z = (col / mapWidth - 1) * scale, y = heightMap[row][col] + offsetY.
+struct HeightPyramid {
+    int mapWidth = 0;
+    int mapHeight = 0;
+    float scale = 1;
+    float offsetY = 0;
+    std::vector<float> heights;
+    std::vector<std::vector<glm::vec2>> levels;
+    std::vector<glm::ivec2> levelSizes;   // (rows, cols) per level
+};
+
+struct TerrainRay {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float maxDistance;
+};
+
+struct TerrainHit {
+    bool hit = false;
+    glm::vec3 position;
+    float distance = 0;
+    glm::ivec2 cell;   // (row, col) in the heightmap
+};
+
+void BuildHeightPyramid(HeightPyramid& pyramid,
+                        const std::vector<std::vector<float>>& heightMap,
+                        float scale,
+                        float offsetY);
+
+// Nearest intersection along a world-space ray, direction need not be normalized.
+bool RaycastTerrain(const HeightPyramid& pyramid, glm::vec3 origin, glm::vec3 direction,
+                    float maxDistance, TerrainHit& hit);
+
+// Casts rays.size() rays; threads <= 0 uses all hardware threads.
+void RaycastTerrainBatch(const HeightPyramid& pyramid, const std::vector<TerrainRay>& rays,
+                         std::vector<TerrainHit>& hits, int threads = 1);
+
+// True when nothing in the terrain blocks the segment between the two points.
+bool TerrainLineOfSight(const HeightPyramid& pyramid, glm::vec3 from, glm::vec3 to);
+
+// Terrain height under the world position, matching the triangles used for ray casting.
+float TerrainHeightAt(const HeightPyramid& pyramid, float x, float z);
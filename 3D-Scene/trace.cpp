@@ -0,0 +1,130 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    struct TraceEvent {
+        const char* name = nullptr;
+        long long start = 0;    // microseconds since the trace epoch
+        long long duration = 0;
+    };
+
+    // Written by its thread only. written counts every event ever recorded, the
+    // event n lives in events[n % size].
+    struct TraceBuffer {
+        int thread = 0;
+        std::atomic<const char*> threadName {nullptr};
+        std::vector<TraceEvent> events;
+        std::atomic<unsigned long long> written {0};
+    };
+
+    // Buffers are never freed, so events of finished threads still get exported
+    struct TraceRegistry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<TraceBuffer>> buffers;
+        std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    };
+
+    TraceRegistry& Registry() {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    TraceBuffer& ThreadBuffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (buffer == nullptr) {
+            TraceRegistry& registry = Registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.buffers.emplace_back(new TraceBuffer());
+            buffer = registry.buffers.back().get();
+            buffer->thread = (int) registry.buffers.size();
+            buffer->events.resize(kTraceEventsPerThread);
+        }
+        return *buffer;
+    }
+
+    long long Microseconds(std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time - Registry().epoch).count();
+    }
+
+    void WriteEscaped(std::ostream& out, const char* text) {
+        out << '"';
+        for (const char* c = text; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                out << '\\';
+            }
+            out << *c;
+        }
+        out << '"';
+    }
+}
+
+TraceZone::TraceZone(const char* name) : name(name), start(std::chrono::steady_clock::now()) {
+}
+
+TraceZone::~TraceZone() {
+    auto end = std::chrono::steady_clock::now();
+    TraceBuffer& buffer = ThreadBuffer();
+    unsigned long long index = buffer.written.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer.events[index % buffer.events.size()];
+    event.name = name;
+    event.start = Microseconds(start);
+    event.duration = Microseconds(end) - event.start;
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+void SetTraceThreadName(const char* name) {
+    ThreadBuffer().threadName.store(name);
+}
+
+bool WriteTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Can't write trace to " << path << "\n";
+        return false;
+    }
+
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& buffer : registry.buffers) {
+        const char* threadName = buffer->threadName.load();
+        if (threadName != nullptr) {
+            out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+                << buffer->thread << ",\"args\":{\"name\":";
+            WriteEscaped(out, threadName);
+            out << "}}";
+            first = false;
+        }
+
+        // Copy first, then drop whatever the thread may have overwritten meanwhile,
+        // including the slot it may be writing right now
+        unsigned long long size = buffer->events.size();
+        unsigned long long end = buffer->written.load(std::memory_order_acquire);
+        unsigned long long begin = end > size ? end - size : 0;
+        std::vector<TraceEvent> events;
+        for (unsigned long long i = begin; i < end; i++) {
+            events.push_back(buffer->events[i % size]);
+        }
+        unsigned long long after = buffer->written.load(std::memory_order_acquire);
+        unsigned long long valid = after >= size ? after - size + 1 : 0;
+
+        for (unsigned long long i = std::max(begin, valid); i < end; i++) {
+            const TraceEvent& event = events[i - begin];
+            out << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"name\":";
+            WriteEscaped(out, event.name);
+            out << ",\"pid\":1,\"tid\":" << buffer->thread
+                << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// CPU trace zones: TRACE_ZONE("name") records the time until the end of the
+// enclosing scope. Every thread writes into its own fixed ring of events, so
+// recording takes no lock and the oldest events are dropped once the ring is
+// full. WriteTrace saves what the rings hold in the Chrome trace format
+// (chrome://tracing, ui.perfetto.dev).
+//
+// Zone and thread names must be string literals or otherwise outlive the trace.
+// Without SCENE_TRACE the macros expand to nothing.
+
+struct TraceZone {
+    explicit TraceZone(const char* name);
+    ~TraceZone();
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Shown instead of the numeric thread id in the trace viewer
+void SetTraceThreadName(const char* name);
+
+// Writes the recorded events of all threads to path. Threads may keep recording
+// meanwhile; events they overwrite during the copy are left out.
+bool WriteTrace(const std::string& path);
+
+// Events per thread ring
+const int kTraceEventsPerThread = 1 << 16;
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef SCENE_TRACE
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD(name) SetTraceThreadName(name)
+#else
+#define TRACE_ZONE(name) ((void) 0)
+#define TRACE_THREAD(name) ((void) 0)
+#endif